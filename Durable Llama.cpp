@@ -1,5 +1,6 @@
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <cstring>
 #include <algorithm>
 #include <signal.h>
@@ -11,240 +12,4806 @@
 #include <sys/types.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/statvfs.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/tcp.h>
+#include <cerrno>
+#include <cstdint>
+#include <cmath>
+#include <climits>
+#include <limits>
 #include <thread>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <type_traits>
 
-volatile sig_atomic_t terminate_requested = 0; // global flag for signal handling
-// called async, so we need to make sure the compiler doesn't change it
+volatile sig_atomic_t terminate_requested = 0; // global flag for graceful termination
+// set by the event loop when SIGINT/SIGTERM (or SIGHUP without --dl-cluster) comes through the signalfd
 
-// graceful termination
-void signal_handler(int signum) {
-    terminate_requested = 1;
+sigset_t supervisor_signals() { // signals the event loop reads from its signalfd instead of a handler
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP); // reload --dl-cluster, or shut down like SIGTERM without one
+    sigaddset(&mask, SIGCHLD); // child exit
+    return mask;
 }
 
+static void append_json_string(std::string& out, const std::string& value) { // quoted and escaped
+    out += '"';
+    for (char c : value) { // JSON string escaping, enough for addresses, paths, messages and prompts
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+static std::string prometheus_label(const std::string& value) { // label value escaping from the text format
+    std::string out;
+    for (char c : value) {
+        if (c == '\\' || c == '"') out += '\\';
+        if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
+
+// supervisor events as JSON lines on their own sink (stderr, or --dl-log) so stdout only carries what the model
+// wrote. callers build a record and queue it; a logger thread does the writing, batched, off the forwarding path
+class EventLog {
+public:
+    class Record { // one line, queued when it goes out of scope
+    public:
+        Record(EventLog& log, const char* event) : log(log) {
+            line.reserve(160);
+            line += "{\"ts_us\":";
+            line += std::to_string(now_us());
+            line += ",\"event\":\"";
+            line += event;
+            line += '"';
+        }
+        Record(const Record&) = delete;
+        ~Record() {
+            line += "}\n";
+            log.push(std::move(line));
+        }
+
+        Record& field(const char* key, const std::string& value) {
+            add_key(key);
+            append_json_string(line, value);
+            return *this;
+        }
+
+        Record& field(const char* key, const char* value) { return field(key, std::string(value)); }
+
+        template <typename T>
+        typename std::enable_if<std::is_arithmetic<T>::value, Record&>::type field(const char* key, T value) {
+            add_key(key);
+            if constexpr (std::is_same<T, bool>::value) {
+                line += value ? "true" : "false";
+            } else if constexpr (std::is_floating_point<T>::value) {
+                char number[32];
+                snprintf(number, sizeof(number), "%.6g", (double)value);
+                line += number;
+            } else {
+                line += std::to_string(value);
+            }
+            return *this;
+        }
+
+    private:
+        EventLog& log;
+        std::string line;
+
+        void add_key(const char* key) {
+            line += ",\"";
+            line += key;
+            line += "\":";
+        }
+    };
+
+    static long long now_us() { // CLOCK_MONOTONIC, same clock as the stall deadlines
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ~EventLog() { stop(); }
+
+    Record emit(const char* event) { return Record(*this, event); }
+
+    bool start(const std::string& path) { // empty path: stderr
+        if (!path.empty()) {
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                perror(("open " + path).c_str());
+                return false;
+            }
+        }
+        running = true;
+        writer = std::thread(&EventLog::writer_loop, this);
+        return true;
+    }
+
+    void stop() { // flushes whatever is queued
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!running) return;
+            running = false;
+        }
+        cv.notify_one();
+        writer.join();
+        if (fd != STDERR_FILENO) close(fd);
+        fd = STDERR_FILENO;
+    }
+
+private:
+    int fd = STDERR_FILENO;
+    std::mutex mtx; // guards everything below
+    std::condition_variable cv;
+    std::vector<std::string> queue;
+    uint64_t dropped = 0;
+    bool running = false;
+    std::thread writer;
+    static constexpr size_t MAX_QUEUED = 4096; // past this a stuck sink costs records, not memory or latency
+
+    void push(std::string&& line) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (queue.size() >= MAX_QUEUED) {
+                dropped++;
+                return;
+            }
+            queue.push_back(std::move(line));
+        }
+        cv.notify_one();
+    }
+
+    void writer_loop() {
+        std::vector<std::string> batch;
+        std::string out;
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            cv.wait(lock, [this] { return !running || !queue.empty(); });
+            if (queue.empty() && !running) return;
+            batch.swap(queue);
+            uint64_t lost = dropped;
+            dropped = 0;
+            lock.unlock();
+
+            out.clear();
+            if (lost > 0) out += "{\"ts_us\":" + std::to_string(now_us()) + ",\"event\":\"log_dropped\",\"records\":" + std::to_string(lost) + "}\n";
+            for (const auto& line : batch) out += line;
+            batch.clear();
+            const char* data = out.data();
+            size_t n = out.size();
+            while (n > 0) { // one write for the whole batch in the common case
+                ssize_t w = write(fd, data, n);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) break; // nowhere left to report it
+                data += w;
+                n -= w;
+            }
+            lock.lock();
+        }
+    }
+};
+
+static EventLog event_log; // started by main() once --dl-log is known, records queue up until then
+
+static void log_error(const char* op) { // perror() as an event, for errno failures in the supervisor
+    int err = errno;
+    event_log.emit("error").field("op", op).field("error", strerror(err));
+}
+
+
+struct ProbeResult { // outcome of probing one server
+    bool reachable = false;
+    long rtt_us = -1; // connect round trip in microseconds, -1 if it never completed
+
+    // filled in by RPC mode probes only
+    bool rpc_ok = false; // HELLO and GET_DEVICE_MEMORY both answered in time
+    bool rpc_legacy = false; // server closed on HELLO, an rpc-server from before the handshake existed
+    bool rpc_timed_out = false; // accepted the connection but never answered, wedged or swapping
+    long rpc_latency_us = -1; // protocol round trip after connect
+    uint64_t free_mem = 0; // backend memory reported by the server
+    uint64_t total_mem = 0;
+    int proto_major = -1, proto_minor = -1, proto_patch = -1;
+
+    bool rpc_healthy() const { // fit to be handed layers
+        return reachable && (rpc_ok || rpc_legacy);
+    }
+};
+
+struct LadderStep { // one rung of --dl-ladder, stacked on top of the rungs before it
+    int ctx = 0; // -c, 0 to leave it alone
+    int batch = 0; // -b and -ub
+    std::string model; // -m, a smaller quant of the same model
+};
+
+struct SupervisorConfig { // options for the wrapper itself, stripped before llama-cli sees them
+    int probe_interval_ms = 1000; // how often the monitor thread probes every server
+    int probe_timeout_ms = 1000; // shared deadline for one background probe round
+    int fail_threshold = 3; // consecutive failed probes before a server (or a llama-server's /health) counts as down
+    bool rpc_check = true; // ggml-rpc round trip against every server before each launch
+    int rpc_budget_ms = 2000; // latency budget for that round trip
+    int load_timeout_ms = 180000; // silence allowed while weights are pushed to the servers
+    int prompt_timeout_ms = 120000; // silence allowed between the end of load and the first output
+    double stall_multiplier = 8.0; // generation stalls after this many p99 inter-token gaps
+    int stall_floor_ms = 250; // never call a generation stall quicker than this
+    int stall_fallback_ms = 5000; // generation limit until enough gaps have been seen
+    int kill_grace_ms = 1000; // between SIGTERM and SIGKILL for a child being replaced
+    std::string standby = "off"; // warm standby topology: off, cpu, or minus-one
+    bool resume = false; // relaunch with the generated prefix and a prompt cache instead of starting over
+    std::string session_dir = "/tmp"; // where the per-run prompt cache lives
+    bool rebalance = true; // explicit --tensor-split and -ngl sized to the surviving servers' memory
+    double mem_headroom = 0.9; // share of a server's free memory we plan to fill with weights
+    std::string mode = "cli"; // cli: one llama-cli run to completion, server: keep a llama-server alive
+    std::string binary; // defaults to ./llama-cli or ./llama-server by mode
+    std::string listen; // server mode: host:port for the request proxy in front of llama-server, empty for none
+    int proxy_inflight = 4; // requests the proxy forwards to the backend at once
+    int proxy_queue = 64; // accepted requests allowed to wait for one of those slots
+    int replay_timeout_ms = 300000; // how long a request waits for the backend to come back before a 503
+    int pools = 1; // server mode: llama-servers to run, each on its own slice of --rpc and its own port
+    std::string metrics_listen; // host:port for the Prometheus endpoint, empty for none
+    std::string log_path; // JSON lines event log, stderr if empty
+    std::string readmit = "restart"; // when recovered servers rejoin: off, restart (next restart, or between proxied requests), immediate
+    int readmit_probes = 5; // consecutive healthy probes before a dropped server counts as recovered
+    int readmit_uptime_ms = 30000; // and how long it has to have stayed up, doubled for each earlier readmission
+    bool rpc_order = true; // put the closest servers first in --rpc instead of keeping command-line order
+    double sticky_slack = 0.25; // share of its even split a server may give up or take on to keep the layers it has, 0 for off
+    std::string model_cache = "warm"; // off, warm (read through the page cache, hinted again before relaunches), pin (mlock)
+    std::string model_stage; // directory, tmpfs ideally, to copy the model into once, empty for none
+    bool model_stage_keep = true; // leave the copy there on exit for the next run, 0 removes it on an orderly shutdown
+    std::string cluster_path; // node file used instead of --rpc, re-read on SIGHUP
+    int dns_ttl_ms = 30000; // how long a resolved hostname is trusted before it's looked up again
+    std::vector<LadderStep> ladder; // tried in order when the servers left can't hold the model, before CPU
+    std::string score_file; // failure scores kept across runs, empty for <session dir>/durable-llama.scores, off for none
+    double score_half_life_s = 3600; // a failure counts half as much this long after it happened
+    double flaky_score = 2.0; // at or above this, a server sits out whenever the others can hold every layer, 0 for never
+    std::string batch_path; // prompt file or directory to run through one server-mode session, then exit
+    std::string batch_out; // JSON lines results, empty for <batch path>.results.jsonl
+    std::string trace_dir; // directory for a Chrome trace of each failover, empty for none
+
+    static bool is_option(const std::string& arg) { // all wrapper options share the --dl- prefix
+        return arg.rfind("--dl-", 0) == 0;
+    }
+
+    bool parse_option(const std::string& name, const std::string& value) { // false if the option is unknown
+        if (name == "--dl-probe-interval") probe_interval_ms = std::max(50, std::stoi(value));
+        else if (name == "--dl-probe-timeout") probe_timeout_ms = std::max(10, std::stoi(value));
+        else if (name == "--dl-fail-threshold") fail_threshold = std::max(1, std::stoi(value));
+        else if (name == "--dl-rpc-check") rpc_check = value != "0";
+        else if (name == "--dl-rpc-budget") rpc_budget_ms = std::max(10, std::stoi(value));
+        else if (name == "--dl-load-timeout") load_timeout_ms = std::max(1000, std::stoi(value));
+        else if (name == "--dl-prompt-timeout") prompt_timeout_ms = std::max(1000, std::stoi(value));
+        else if (name == "--dl-stall-multiplier") stall_multiplier = std::max(1.0, std::stod(value));
+        else if (name == "--dl-stall-floor") stall_floor_ms = std::max(10, std::stoi(value));
+        else if (name == "--dl-stall-fallback") stall_fallback_ms = std::max(100, std::stoi(value));
+        else if (name == "--dl-kill-grace") kill_grace_ms = std::max(0, std::stoi(value));
+        else if (name == "--dl-resume") resume = value != "0";
+        else if (name == "--dl-session-dir") session_dir = value;
+        else if (name == "--dl-rebalance") rebalance = value != "0";
+        else if (name == "--dl-mem-headroom") mem_headroom = std::min(1.0, std::max(0.1, std::stod(value)));
+        else if (name == "--dl-mode") {
+            if (value != "cli" && value != "server") return false;
+            mode = value;
+        }
+        else if (name == "--dl-binary") binary = value;
+        else if (name == "--dl-listen") listen = value;
+        else if (name == "--dl-max-inflight") proxy_inflight = std::max(1, std::stoi(value));
+        else if (name == "--dl-queue") proxy_queue = std::max(0, std::stoi(value));
+        else if (name == "--dl-replay-timeout") replay_timeout_ms = std::max(0, std::stoi(value));
+        else if (name == "--dl-pools") pools = std::max(1, std::stoi(value));
+        else if (name == "--dl-metrics") metrics_listen = value;
+        else if (name == "--dl-log") log_path = value;
+        else if (name == "--dl-readmit") {
+            if (value != "off" && value != "restart" && value != "immediate") return false;
+            readmit = value;
+        }
+        else if (name == "--dl-readmit-probes") readmit_probes = std::max(1, std::stoi(value));
+        else if (name == "--dl-readmit-uptime") readmit_uptime_ms = std::max(0, std::stoi(value));
+        else if (name == "--dl-rpc-order") rpc_order = value != "0";
+        else if (name == "--dl-sticky-slack") sticky_slack = std::min(1.0, std::max(0.0, std::stod(value)));
+        else if (name == "--dl-model-cache") {
+            if (value != "off" && value != "warm" && value != "pin") return false;
+            model_cache = value;
+        }
+        else if (name == "--dl-model-stage") model_stage = value;
+        else if (name == "--dl-model-stage-keep") model_stage_keep = value != "0";
+        else if (name == "--dl-cluster") cluster_path = value;
+        else if (name == "--dl-dns-ttl") dns_ttl_ms = std::max(1000, std::stoi(value));
+        else if (name == "--dl-ladder") return parse_ladder(value);
+        else if (name == "--dl-score-file") score_file = value;
+        else if (name == "--dl-score-half-life") score_half_life_s = std::max(1.0, std::stod(value));
+        else if (name == "--dl-flaky-score") flaky_score = std::max(0.0, std::stod(value));
+        else if (name == "--dl-batch") batch_path = value;
+        else if (name == "--dl-batch-out") batch_out = value;
+        else if (name == "--dl-trace") trace_dir = value;
+        else if (name == "--dl-standby") {
+            if (value != "off" && value != "cpu" && value != "minus-one") return false;
+            standby = value;
+        }
+        else return false;
+        return true;
+    }
+
+    // rungs separated by commas, settings within a rung by +: ctx=2048,batch=256,model=q3.gguf+ctx=1024
+    bool parse_ladder(const std::string& value) {
+        ladder.clear();
+        std::stringstream steps(value);
+        std::string step;
+        while (std::getline(steps, step, ',')) {
+            LadderStep rung;
+            std::stringstream parts(step);
+            std::string part;
+            while (std::getline(parts, part, '+')) {
+                size_t eq = part.find('=');
+                if (eq == std::string::npos) return false;
+                std::string key = part.substr(0, eq), setting = part.substr(eq + 1);
+                if (key == "ctx") rung.ctx = std::max(1, std::stoi(setting));
+                else if (key == "batch") rung.batch = std::max(1, std::stoi(setting));
+                else if (key == "model" && !setting.empty()) rung.model = setting;
+                else return false;
+            }
+            ladder.push_back(rung);
+        }
+        return true;
+    }
+
+    bool server_mode() const { return mode == "server"; }
+
+    std::string llama_binary() const {
+        if (!binary.empty()) return binary;
+        return server_mode() ? "./llama-server" : "./llama-cli";
+    }
+};
+
+struct NodeSpec { // one node of the cluster file, or an --rpc entry with everything left at its default
+    std::string address;
+    uint64_t ram = 0; // bytes to plan with if the node reports none, and a ceiling on what it reports. 0 for no say
+    double speed = 1.0; // relative compute, scales the node's share of the layers
+    int priority = 0; // lower goes first in --rpc, ahead of the latency order
+    int max_layers = 0; // 0 for no limit beyond memory
+    int pool = -1; // server mode: which llama-server it serves, -1 to spread nodes evenly
+    bool standby = false; // held back until a regular node of its pool goes down
+};
+
+struct RPCServer { // rpc server endpoint
+    std::string address;
+    std::string ip; // host part: IPv4, IPv6 without the brackets, or a name
+    int port;
+    bool available;
+    int pool; // which backend's --rpc list it belongs to
+    NodeSpec spec; // what the cluster file says about it
+    bool retired; // gone from the cluster file, kept so indices into servers stay valid
+
+    // where probes connect and what goes into --rpc, copied from the resolver's cache. len 0 until resolved
+    sockaddr_storage endpoint;
+    socklen_t endpoint_len;
+    std::string numeric_address; // endpoint as ip:port or [ip]:port
+
+    // rolling health state, written under DurableLLaMA::mtx
+    bool healthy; // result of the latest probe
+    long last_rtt_us; // RTT of the latest successful probe
+    double smoothed_rtt_us; // EWMA of the probe RTTs, a single connect() is too noisy to order servers by
+    int consecutive_failures;
+    int consecutive_successes;
+    std::chrono::steady_clock::time_point state_since; // up since / down since
+    std::chrono::steady_clock::time_point last_probe;
+    int readmissions; // times it was dropped and let back in, each one makes the next wait longer
+    double failure_score; // decaying count of recent failures, as of score_time
+    std::chrono::steady_clock::time_point score_time;
+    bool benched; // left out for being flaky while the others have room, for logging the change only
+    // connected to a running llama-cli, llama-server or standby. rpc-server serves one client with a backlog
+    // of 1, so probes would only queue up behind it and time out: the child's own exit or stall says it's gone
+    bool in_use;
+
+    // layers it was given by the last launch that used it. kept across drops: rpc-server -c caches tensors on
+    // the node's own disk, so a server that comes back still has them
+    int held_first;
+    int held_count;
+
+    // backend state from the latest ggml-rpc check
+    uint64_t free_mem;
+    uint64_t total_mem;
+    long rpc_latency_us;
+    std::chrono::steady_clock::time_point rpc_checked; // when rpc_latency_us was measured
+
+    RPCServer(const NodeSpec& node) : // constructor to initialize and parse addr
+        address(node.address),
+        available(true),
+        pool(0),
+        retired(false),
+        endpoint_len(0),
+        healthy(true),
+        last_rtt_us(-1),
+        smoothed_rtt_us(-1),
+        consecutive_failures(0),
+        consecutive_successes(0),
+        state_since(std::chrono::steady_clock::now()),
+        readmissions(0),
+        failure_score(0),
+        score_time(std::chrono::steady_clock::now()),
+        benched(false),
+        in_use(false),
+        held_first(-1),
+        held_count(0),
+        free_mem(0),
+        total_mem(0),
+        rpc_latency_us(-1) {
+        spec = node;
+        memset(&endpoint, 0, sizeof(endpoint));
+        parse_address();
+    }
+
+    const std::string& rpc_address() const { // resolved if we can, the configured name otherwise
+        return endpoint_len > 0 ? numeric_address : address;
+    }
+
+    uint64_t planning_mem() const { // memory the split may count on, 0 if nothing is known
+        if (spec.ram == 0) return free_mem;
+        return free_mem == 0 ? spec.ram : std::min(free_mem, spec.ram);
+    }
+
+    void record_probe(const ProbeResult& probe, std::chrono::steady_clock::time_point now) { // fold one probe into the health state
+        if (probe.reachable != healthy) state_since = now; // went up or down
+        healthy = probe.reachable;
+        last_probe = now;
+        if (probe.reachable) {
+            last_rtt_us = probe.rtt_us;
+            smoothed_rtt_us = smoothed_rtt_us < 0 ? probe.rtt_us : smoothed_rtt_us * (1 - RTT_ALPHA) + probe.rtt_us * RTT_ALPHA;
+            consecutive_failures = 0;
+            consecutive_successes++;
+        } else {
+            consecutive_failures++;
+            consecutive_successes = 0;
+        }
+    }
+
+    // one round trip from here, from whichever measurement is newer. -1 until something has been measured,
+    // or once that is older than max_age: an in_use server isn't probed, its last RTT predates the launch
+    long network_cost_us(std::chrono::steady_clock::time_point now, std::chrono::milliseconds max_age) const {
+        bool probed = smoothed_rtt_us >= 0, checked = rpc_latency_us > 0;
+        if (checked && (!probed || rpc_checked > last_probe)) {
+            return now - rpc_checked <= max_age ? rpc_latency_us / 2 : -1; // HELLO + GET_DEVICE_MEMORY is two round trips
+        }
+        return probed && now - last_probe <= max_age ? (long)smoothed_rtt_us : -1;
+    }
+
+    // dropped, but has been answering long enough that letting it back in shouldn't just cost another restart
+    bool recovered(const SupervisorConfig& config, std::chrono::steady_clock::time_point now) const {
+        if (available || retired || !healthy || consecutive_successes < config.readmit_probes) return false;
+        long required_ms = (long)config.readmit_uptime_ms << std::min(readmissions, 5); // a flapping node waits longer each time
+        return now - state_since >= std::chrono::milliseconds(required_ms);
+    }
+
+    double score(std::chrono::steady_clock::time_point now, double half_life_s) const { // decayed to now
+        double age_s = std::chrono::duration<double>(now - score_time).count();
+        return failure_score * std::exp2(-std::max(0.0, age_s) / half_life_s);
+    }
+
+    void record_failure(std::chrono::steady_clock::time_point now, double half_life_s) {
+        failure_score = score(now, half_life_s) + 1;
+        score_time = now;
+    }
+
+    static constexpr double RTT_ALPHA = 0.2;
+
+    void parse_address() { // host:port, [v6]:port, or a bare host or IPv6 address on the default port
+        port = 50053; // RPC port for the PIs
+        size_t colon_pos = address.rfind(':');
+        if (!address.empty() && address[0] == '[') {
+            size_t close = address.find(']');
+            ip = address.substr(1, close == std::string::npos ? std::string::npos : close - 1);
+            if (close != std::string::npos && colon_pos == close + 1) port = std::stoi(address.substr(colon_pos + 1));
+        } else if (colon_pos != std::string::npos && address.find(':') == colon_pos) {
+            ip = address.substr(0, colon_pos);
+            port = std::stoi(address.substr(colon_pos + 1));
+        } else {
+            ip = address;
+        }
+    }
+};
+
+// the cluster file: one node per line, the address then key=value settings, # starts a comment.
+//   192.168.1.21:50052 ram=8G speed=1.5 priority=0 max-layers=20 pool=0 role=active
+//   [fd00::22]:50052 speed=0.7
+//   pi3.local role=standby
+// ram takes a K/M/G suffix and means MiB without one
+class ClusterFile {
+public:
+    static bool load(const std::string& path, std::vector<NodeSpec>& nodes, std::string& error) {
+        std::ifstream file(path);
+        if (!file) {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        nodes.clear();
+        std::string line;
+        for (int number = 1; std::getline(file, line); number++) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            NodeSpec node;
+            if (!(fields >> node.address)) continue; // blank or comment
+            std::string setting;
+            while (fields >> setting) {
+                if (!apply(node, setting)) {
+                    error = path + ":" + std::to_string(number) + ": bad setting " + setting;
+                    return false;
+                }
+            }
+            if (std::any_of(nodes.begin(), nodes.end(), [&](const NodeSpec& n) { return n.address == node.address; })) {
+                error = path + ":" + std::to_string(number) + ": " + node.address + " listed twice";
+                return false;
+            }
+            try {
+                RPCServer server(node);
+                if (server.ip.empty() || server.port <= 0 || server.port > 65535) throw std::out_of_range("port");
+            } catch (const std::exception&) {
+                error = path + ":" + std::to_string(number) + ": bad address " + node.address;
+                return false;
+            }
+            nodes.push_back(node);
+        }
+        if (nodes.empty()) error = path + ": no nodes";
+        return !nodes.empty();
+    }
+
+private:
+    static bool apply(NodeSpec& node, const std::string& setting) {
+        size_t eq = setting.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = setting.substr(0, eq), value = setting.substr(eq + 1);
+        try {
+            size_t used = 0;
+            if (key == "ram") {
+                double amount = std::stod(value, &used);
+                std::string unit = value.substr(used);
+                int shift = unit.empty() || unit == "M" || unit == "MiB" ? 20 : unit == "G" || unit == "GiB" ? 30 :
+                            unit == "K" || unit == "KiB" ? 10 : -1;
+                if (shift < 0 || amount < 0) return false;
+                node.ram = (uint64_t)(amount * (1ULL << shift));
+                return true;
+            }
+            if (key == "role") {
+                if (value != "active" && value != "standby") return false;
+                node.standby = value == "standby";
+                return true;
+            }
+            if (key == "speed") node.speed = std::stod(value, &used);
+            else if (key == "priority") node.priority = std::stoi(value, &used);
+            else if (key == "max-layers") node.max_layers = std::stoi(value, &used);
+            else if (key == "pool") node.pool = std::stoi(value, &used);
+            else return false;
+            return used == value.size() && node.speed > 0 && node.max_layers >= 0 && node.pool >= -1;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+};
+
+// hostnames resolved off the failover path. a worker looks up every watched name when its TTL runs out, one
+// thread per lookup so a dead mDNS name can't hold up the rest, and everyone else only reads the cache.
+// a failed lookup keeps serving the last good address; literals never touch it
+class Resolver {
+public:
+    struct Entry {
+        sockaddr_storage addr; // port left 0, the caller fills in its own
+        socklen_t len = 0;
+        std::string numeric;
+    };
+
+    void start(int ttl_ms) {
+        ttl = std::chrono::milliseconds(ttl_ms);
+        running = true;
+        worker = std::thread(&Resolver::loop, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!running) return;
+            running = false;
+        }
+        cv.notify_all();
+        worker.join();
+        for (auto& lookup : lookups) lookup.second.join(); // getaddrinfo can't be cancelled, its own timeout bounds this
+        lookups.clear();
+    }
+
+    ~Resolver() { stop(); }
+
+    static void set_port(sockaddr_storage& addr, int port) { // entries come back with port 0
+        if (addr.ss_family == AF_INET6) reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port = htons(port);
+        else reinterpret_cast<sockaddr_in*>(&addr)->sin_port = htons(port);
+    }
+
+    void watch(const std::string& host) { // returns right away, the lookup happens on the worker
+        if (literal(host, nullptr)) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!hosts.emplace(host, Cached()).second) return;
+        cv.notify_all();
+    }
+
+    bool lookup(const std::string& host, Entry& out) { // cache only, never blocks on the network
+        if (literal(host, &out)) return true;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = hosts.find(host);
+        if (it == hosts.end() || it->second.entry.len == 0) return false;
+        out = it->second.entry;
+        return true;
+    }
+
+    // startup only: give the first lookups a moment so the first launch doesn't go out without them
+    void wait_resolved(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait_for(lock, timeout, [this] {
+            return std::all_of(hosts.begin(), hosts.end(), [](const std::pair<const std::string, Cached>& h) {
+                return h.second.attempted;
+            });
+        });
+    }
+
+private:
+    struct Cached {
+        Entry entry;
+        bool attempted = false; // looked up at least once, successfully or not
+        bool in_flight = false; // a lookup for it is running, never two at once
+        int failures = 0; // in a row, the retry backs off with them
+        std::chrono::steady_clock::time_point due; // next lookup, default is right away
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::map<std::string, Cached> hosts;
+    std::chrono::milliseconds ttl{30000};
+    bool running = false;
+    std::thread worker;
+    std::map<std::string, std::thread> lookups; // worker only, one per name in flight
+    static constexpr int RETRY_MS = 1000; // first retry after a failed lookup, the stale address is still served meanwhile
+
+    static bool literal(const std::string& host, Entry* out) {
+        Entry entry;
+        memset(&entry.addr, 0, sizeof(entry.addr));
+        auto* v4 = reinterpret_cast<sockaddr_in*>(&entry.addr);
+        auto* v6 = reinterpret_cast<sockaddr_in6*>(&entry.addr);
+        if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            entry.len = sizeof(sockaddr_in);
+        } else if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            entry.len = sizeof(sockaddr_in6);
+        } else {
+            return false;
+        }
+        entry.numeric = host;
+        if (out) *out = entry;
+        return true;
+    }
+
+    static bool resolve(const std::string& host, Entry& out) { // blocking, worker threads only
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_ADDRCONFIG; // no AAAA answers on a node without IPv6
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || !result) return false;
+        memset(&out.addr, 0, sizeof(out.addr));
+        memcpy(&out.addr, result->ai_addr, result->ai_addrlen); // first one, getaddrinfo already sorted them
+        out.len = result->ai_addrlen;
+        freeaddrinfo(result);
+        char text[INET6_ADDRSTRLEN] = {0};
+        const void* raw = out.addr.ss_family == AF_INET6 ? (const void*)&reinterpret_cast<sockaddr_in6*>(&out.addr)->sin6_addr
+                                                         : (const void*)&reinterpret_cast<sockaddr_in*>(&out.addr)->sin_addr;
+        inet_ntop(out.addr.ss_family, raw, text, sizeof(text));
+        out.numeric = text;
+        return true;
+    }
+
+    // starts a lookup for every name that's due and isn't already being looked up, and joins the ones that
+    // have published. each result goes in as soon as its own lookup ends, however long the others take
+    void loop() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (running) {
+            for (auto it = lookups.begin(); it != lookups.end();) {
+                if (hosts[it->first].in_flight) {
+                    ++it;
+                    continue;
+                }
+                it->second.join(); // published and on its way out
+                it = lookups.erase(it);
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            auto next = now + ttl;
+            for (auto& host : hosts) {
+                if (host.second.in_flight) continue;
+                if (host.second.due > now) {
+                    next = std::min(next, host.second.due);
+                    continue;
+                }
+                host.second.in_flight = true;
+                lookups.emplace(host.first, std::thread(&Resolver::lookup_one, this, host.first));
+            }
+            cv.wait_until(lock, next); // a finished lookup or a new name wakes us earlier
+        }
+    }
+
+    void lookup_one(std::string host) { // one name on a thread of its own
+        Entry result;
+        bool ok = resolve(host, result);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& cached = hosts[host];
+        auto now = std::chrono::steady_clock::now();
+        cached.in_flight = false;
+        cached.attempted = true;
+        if (!ok) {
+            auto retry = std::chrono::milliseconds(RETRY_MS << std::min(cached.failures, 5));
+            cached.due = now + std::min<std::chrono::milliseconds>(ttl, retry);
+            if (cached.failures++ == 0) event_log.emit("dns_failed").field("host", host).field("serving", cached.entry.numeric);
+        } else {
+            cached.failures = 0;
+            if (result.numeric != cached.entry.numeric) {
+                event_log.emit("dns_resolved").field("host", host).field("address", result.numeric)
+                    .field("previous", cached.entry.numeric);
+            }
+            cached.entry = result;
+            cached.due = now + ttl;
+        }
+        cv.notify_all();
+    }
+};
+
+enum class ProbeMode {
+    TCP, // connect() only
+    RPC  // connect, then a ggml-rpc HELLO + GET_DEVICE_MEMORY round trip
+};
+
+class ProbeEngine { // probes every server at once instead of one blocking connect() at a time
+public:
+    // opens a non-blocking socket per server and waits for all of them with one poll() and a shared deadline,
+    // so a round costs about one RTT, or one timeout in the worst case, no matter how many servers are dead.
+    // in RPC mode the same deadline is the latency budget for the protocol round trip
+    static std::vector<ProbeResult> probe_all(const std::vector<RPCServer>& servers, int timeout_ms,
+                                              ProbeMode mode = ProbeMode::TCP) {
+        std::vector<ProbeResult> results(servers.size());
+        std::vector<Probe> probes; // connections still in flight
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < servers.size(); i++) {
+            const auto& server = servers[i];
+            if (server.endpoint_len == 0) continue; // name not resolved yet, counts as unreachable
+
+            int sockfd = socket(server.endpoint.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (sockfd < 0) {
+                log_error("socket");
+                continue;
+            }
+
+            int result = connect(sockfd, (const struct sockaddr*)&server.endpoint, server.endpoint_len);
+            if (result == 0 || errno == EINPROGRESS) { // connected or handshake started, finish it in the poll loop
+                Probe probe;
+                probe.fd = sockfd;
+                probe.owner = i;
+                probes.push_back(probe);
+            } else {
+                close(sockfd); // refused or no route, fails immediately
+            }
+        }
+
+        auto deadline = start + std::chrono::milliseconds(timeout_ms);
+        std::vector<struct pollfd> pfds(probes.size());
+        size_t pending = probes.size();
+        while (pending > 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) break; // shared deadline reached, whatever is left failed
+
+            for (size_t k = 0; k < probes.size(); k++) {
+                pfds[k].fd = probes[k].fd; // poll() ignores negative fds
+                pfds[k].events = probes[k].stage == RECV_HELLO || probes[k].stage == RECV_MEMORY ? POLLIN : POLLOUT;
+                pfds[k].revents = 0;
+            }
+
+            int ready = poll(pfds.data(), pfds.size(), (int)remaining);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                log_error("poll");
+                break;
+            }
+
+            for (size_t k = 0; k < probes.size(); k++) {
+                if (probes[k].fd < 0 || pfds[k].revents == 0) continue;
+                if (!advance(probes[k], results[probes[k].owner], mode, start)) {
+                    close(probes[k].fd);
+                    probes[k].fd = -1;
+                    pending--;
+                }
+            }
+        }
+
+        for (auto& probe : probes) { // ran out of time
+            if (probe.fd < 0) continue;
+            if (probe.stage != CONNECTING) results[probe.owner].rpc_timed_out = true; // accepted but never answered
+            close(probe.fd);
+        }
+        return results;
+    }
+
+    // GET a path over plain HTTP and return the status code, -1 if nothing usable came back in time
+    // addr from the resolver with the port set, len 0 while the name is unresolved; host only goes in the Host header
+    static int http_status(const sockaddr_storage& addr, socklen_t len, const std::string& host, const std::string& path,
+                           int timeout_ms) {
+        if (len == 0) return -1;
+        int sockfd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sockfd < 0) return -1;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        int status = -1;
+        std::string authority = host.find(':') != std::string::npos ? "[" + host + "]" : host; // IPv6 literal
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + authority + "\r\nConnection: close\r\n\r\n";
+        std::string reply;
+        if ((connect(sockfd, (const struct sockaddr*)&addr, len) == 0 || errno == EINPROGRESS) &&
+            wait_for(sockfd, POLLOUT, deadline)) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0 && send(sockfd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size()) {
+                char buffer[256];
+                while (reply.find("\r\n") == std::string::npos && wait_for(sockfd, POLLIN, deadline)) {
+                    ssize_t n = recv(sockfd, buffer, sizeof(buffer), 0);
+                    if (n <= 0) break;
+                    reply.append(buffer, n);
+                }
+            }
+        }
+        close(sockfd);
+
+        if (reply.compare(0, 5, "HTTP/") == 0) { // "HTTP/1.1 200 OK"
+            size_t space = reply.find(' ');
+            if (space != std::string::npos) status = atoi(reply.c_str() + space + 1);
+        }
+        return status;
+    }
+
+private:
+    static bool wait_for(int fd, short events, std::chrono::steady_clock::time_point deadline) {
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return false;
+            struct pollfd pfd = {fd, events, 0};
+            int ready = poll(&pfd, 1, (int)remaining);
+            if (ready < 0 && errno == EINTR) continue;
+            return ready > 0;
+        }
+    }
+
+    // ggml-rpc wire format: 1 byte command, 8 byte payload size, payload; replies are size + payload
+    static constexpr uint8_t RPC_CMD_GET_DEVICE_MEMORY = 11;
+    static constexpr uint8_t RPC_CMD_HELLO = 14; // must be the first command on a connection
+
+    enum Stage { CONNECTING, SEND_HELLO, RECV_HELLO, SEND_MEMORY, RECV_MEMORY };
+
+    struct Probe { // one in-flight probe connection
+        int fd = -1;
+        size_t owner = 0; // index into servers
+        Stage stage = CONNECTING;
+        std::string out; // request bytes still to send
+        size_t out_off = 0;
+        std::string in; // reply bytes received so far
+        std::chrono::steady_clock::time_point rpc_start;
+    };
+
+    static long elapsed_us(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - since).count();
+    }
+
+    static std::string rpc_message(uint8_t cmd, const std::string& payload) {
+        uint64_t size = payload.size();
+        std::string msg(1, (char)cmd);
+        msg.append((const char*)&size, sizeof(size)); // rpc-server uses host byte order, little endian on the Pis
+        msg += payload;
+        return msg;
+    }
+
+    // moves one probe forward after poll() reported it ready, returns false once it's finished either way
+    static bool advance(Probe& probe, ProbeResult& result, ProbeMode mode, std::chrono::steady_clock::time_point start) {
+        if (probe.stage == CONNECTING) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(probe.fd, SOL_SOCKET, SO_ERROR, &err, &len); // result of the async connect
+            if (err != 0) return false;
+
+            result.reachable = true;
+            result.rtt_us = elapsed_us(start);
+            if (mode == ProbeMode::TCP) return false;
+
+            probe.stage = SEND_HELLO;
+            probe.out = rpc_message(RPC_CMD_HELLO, "");
+            probe.rpc_start = std::chrono::steady_clock::now();
+        }
+
+        if (probe.stage == SEND_HELLO || probe.stage == SEND_MEMORY) {
+            ssize_t n = send(probe.fd, probe.out.data() + probe.out_off, probe.out.size() - probe.out_off, MSG_NOSIGNAL);
+            if (n < 0) return errno == EAGAIN || errno == EINTR;
+            probe.out_off += n;
+            if (probe.out_off < probe.out.size()) return true;
+            probe.stage = probe.stage == SEND_HELLO ? RECV_HELLO : RECV_MEMORY;
+            probe.in.clear();
+            return true;
+        }
+
+        char buffer[64];
+        ssize_t n = recv(probe.fd, buffer, sizeof(buffer), 0);
+        if (n < 0) return errno == EAGAIN || errno == EINTR;
+        if (n == 0) { // server hung up
+            if (probe.stage == RECV_HELLO && probe.in.empty()) result.rpc_legacy = true; // pre-HELLO rpc-server drops unknown commands
+            return false;
+        }
+        probe.in.append(buffer, n);
+
+        size_t expected = probe.stage == RECV_HELLO ? 3 : 16; // version triple, or free + total memory
+        if (probe.in.size() < sizeof(uint64_t)) return true;
+        uint64_t size;
+        memcpy(&size, probe.in.data(), sizeof(size));
+        if (size != expected) return false; // not something we understand, leave rpc_ok unset
+        if (probe.in.size() < sizeof(uint64_t) + expected) return true;
+
+        const char* payload = probe.in.data() + sizeof(uint64_t);
+        if (probe.stage == RECV_HELLO) {
+            result.proto_major = (uint8_t)payload[0];
+            result.proto_minor = (uint8_t)payload[1];
+            result.proto_patch = (uint8_t)payload[2];
+            std::string request;
+            if (result.proto_major >= 3) { // multi-device servers take a device index
+                uint32_t device = 0;
+                request.assign((const char*)&device, sizeof(device));
+            }
+            probe.stage = SEND_MEMORY;
+            probe.out = rpc_message(RPC_CMD_GET_DEVICE_MEMORY, request);
+            probe.out_off = 0;
+            return advance(probe, result, mode, start); // socket is almost certainly writable, don't wait for poll
+        }
+
+        memcpy(&result.free_mem, payload, sizeof(uint64_t));
+        memcpy(&result.total_mem, payload + sizeof(uint64_t), sizeof(uint64_t));
+        result.rpc_ok = true;
+        result.rpc_latency_us = elapsed_us(probe.rpc_start);
+        return false;
+    }
+};
+
+enum class RunPhase { LOAD, PROMPT_EVAL, GENERATION, SERVING }; // SERVING: llama-server up, liveness comes from /health
+
+class StallDetector { // decides when silence from llama-cli means it's stuck, with a separate limit per phase
+public:
+    explicit StallDetector(const SupervisorConfig& cfg) : config(cfg) {
+        reset(std::chrono::steady_clock::now());
+    }
+
+    void reset(std::chrono::steady_clock::time_point now, RunPhase phase = RunPhase::LOAD) { // new process, back to loading
+        current = phase;
+        last_activity = now;
+        gaps.clear();
+        next_gap = 0;
+        since_p99 = 0;
+        p99_gap_ms = 0;
+        tail.clear();
+    }
+
+    // data may be null once in generation, only the timing matters from then on
+    void on_output(const char* data, size_t n, std::chrono::steady_clock::time_point now) {
+        if (current == RunPhase::LOAD) {
+            // llama-cli prints this right before it starts evaluating the prompt
+            std::string window = tail + std::string(data, n);
+            if (window.find(LOAD_DONE_MARKER) != std::string::npos) {
+                current = RunPhase::PROMPT_EVAL;
+                tail.clear();
+            } else {
+                size_t keep = std::min(window.size(), sizeof(LOAD_DONE_MARKER) - 1); // marker may straddle two reads
+                tail = window.substr(window.size() - keep);
+            }
+        } else if (current == RunPhase::PROMPT_EVAL) {
+            current = RunPhase::GENERATION; // prompt echo and tokens from here on
+        } else if (current == RunPhase::GENERATION) {
+            record_gap(std::chrono::duration<double, std::milli>(now - last_activity).count());
+        }
+        last_activity = now;
+    }
+
+    // a line of the child's stderr: the load marker ends the load, anything else logged during load is progress.
+    // after that logs say nothing about tokens, only stdout does
+    void on_log_line(const std::string& line, std::chrono::steady_clock::time_point now) {
+        if (current != RunPhase::LOAD) return;
+        if (line.find(LOAD_DONE_MARKER) != std::string::npos) current = RunPhase::PROMPT_EVAL;
+        last_activity = now;
+    }
+
+    void on_progress(std::chrono::steady_clock::time_point now) { // one of llama.cpp's load progress dots
+        if (current == RunPhase::LOAD) last_activity = now;
+    }
+
+    long limit_ms() const { // silence allowed in the current phase
+        switch (current) {
+            case RunPhase::LOAD: return config.load_timeout_ms;
+            case RunPhase::PROMPT_EVAL: return config.prompt_timeout_ms;
+            case RunPhase::GENERATION:
+                if (gaps.size() < MIN_GAP_SAMPLES) return config.stall_fallback_ms; // not enough data yet
+                return std::max((long)config.stall_floor_ms, (long)(p99_gap_ms * config.stall_multiplier));
+            case RunPhase::SERVING: return -1; // no limit, only /health decides
+        }
+        return config.stall_fallback_ms;
+    }
+
+    long silent_ms(std::chrono::steady_clock::time_point now) const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now - last_activity).count();
+    }
+
+    // when the current phase would count as stalled. never for a server that's up: it logs its requests to
+    // stderr, not stdout, and idles silently, so silence says nothing about it
+    std::chrono::steady_clock::time_point deadline() const {
+        if (current == RunPhase::SERVING) return std::chrono::steady_clock::time_point::max();
+        return last_activity + std::chrono::milliseconds(limit_ms());
+    }
+
+    bool stalled(std::chrono::steady_clock::time_point now) const {
+        return current != RunPhase::SERVING && silent_ms(now) >= limit_ms();
+    }
+
+    RunPhase phase() const { return current; }
+
+    bool needs_content() const { // still looking for the load marker
+        return current == RunPhase::LOAD;
+    }
+
+    const char* phase_name() const {
+        switch (current) {
+            case RunPhase::LOAD: return "model load";
+            case RunPhase::PROMPT_EVAL: return "prompt eval";
+            case RunPhase::GENERATION: return "generation";
+            case RunPhase::SERVING: return "serving";
+        }
+        return "unknown";
+    }
+
+    static constexpr char LOAD_DONE_MARKER[] = "generate: n_ctx";
+
+private:
+    static constexpr size_t MIN_GAP_SAMPLES = 16;
+    static constexpr size_t MAX_GAP_SAMPLES = 256; // rolling window, so the limit follows the current token rate
+    static constexpr size_t P99_EVERY = MIN_GAP_SAMPLES; // gaps between p99 updates, a lag of a few tokens at most
+
+    const SupervisorConfig& config;
+    RunPhase current;
+    std::chrono::steady_clock::time_point last_activity;
+    std::vector<double> gaps; // inter-output gaps in ms, ring buffer once full
+    std::vector<double> scratch; // reused for the selection, never reallocated once the window has filled
+    size_t next_gap;
+    size_t since_p99; // gaps recorded since p99_gap_ms was last worked out
+    double p99_gap_ms;
+    std::string tail; // end of the previous read, for marker matching
+
+    void record_gap(double gap_ms) {
+        if (gaps.size() < MAX_GAP_SAMPLES) {
+            gaps.push_back(gap_ms);
+        } else {
+            gaps[next_gap] = gap_ms;
+            next_gap = (next_gap + 1) % MAX_GAP_SAMPLES;
+        }
+        // the selection is O(window) and this runs per chunk of output, so only every P99_EVERY gaps. the
+        // first update lands on MIN_GAP_SAMPLES, when limit_ms() starts to use it
+        if (++since_p99 < P99_EVERY) return;
+        since_p99 = 0;
+        scratch.assign(gaps.begin(), gaps.end());
+        size_t idx = (scratch.size() * 99) / 100;
+        std::nth_element(scratch.begin(), scratch.begin() + idx, scratch.end());
+        p99_gap_ms = scratch[idx];
+    }
+};
+
+// splits a child's stderr into lines and picks out llama.cpp's load progress, which it prints as one dot per
+// percent on a line of its own
+class ChildLogParser {
+public:
+    void reset() {
+        partial.clear();
+        dots = true;
+    }
+
+    template <typename OnLine, typename OnProgress>
+    void feed(const char* data, size_t n, OnLine on_line, OnProgress on_progress) {
+        for (size_t i = 0; i < n; i++) {
+            char c = data[i];
+            if (c == '\n' || partial.size() >= MAX_LINE) { // an overlong line goes out in pieces
+                if (!partial.empty() && !dots) on_line(partial); // a finished progress line is not news
+                reset();
+                if (c == '\n') continue;
+            }
+            if (c == '\r') continue;
+            partial += c;
+            dots = dots && c == '.';
+            if (dots) on_progress((int)std::min<size_t>(100, partial.size()));
+        }
+    }
+
+private:
+    static constexpr size_t MAX_LINE = 4096;
+    std::string partial; // line so far
+    bool dots = true; // nothing but dots so far
+};
+
+// bytes a process has moved over TCP, summed over its sockets from inet_diag's tcp_info. during load that's
+// the weights going out to the rpc servers, which llama-cli does quietly
+class SocketCounters {
+public:
+    // false if the process has no TCP sockets we can see, or the kernel has no sock_diag
+    static bool sample(pid_t pid, uint64_t& bytes) {
+        std::vector<uint64_t> inodes = socket_inodes(pid);
+        if (inodes.empty()) return false;
+        int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+        if (fd < 0) return false;
+        bytes = 0;
+        bool found = false;
+        for (int family : {AF_INET, AF_INET6}) found = dump(fd, family, inodes, bytes) || found;
+        close(fd);
+        return found;
+    }
+
+private:
+    static std::vector<uint64_t> socket_inodes(pid_t pid) { // sorted, from the socket:[inode] links in /proc/pid/fd
+        std::vector<uint64_t> inodes;
+        DIR* dir = opendir(("/proc/" + std::to_string(pid) + "/fd").c_str());
+        if (!dir) return inodes;
+        char target[64];
+        while (struct dirent* entry = readdir(dir)) {
+            ssize_t n = readlinkat(dirfd(dir), entry->d_name, target, sizeof(target) - 1);
+            if (n <= 0) continue;
+            target[n] = '\0';
+            unsigned long long inode;
+            if (sscanf(target, "socket:[%llu]", &inode) == 1) inodes.push_back(inode);
+        }
+        closedir(dir);
+        std::sort(inodes.begin(), inodes.end());
+        return inodes;
+    }
+
+    static bool dump(int fd, int family, const std::vector<uint64_t>& inodes, uint64_t& bytes) {
+        struct {
+            struct nlmsghdr header;
+            struct inet_diag_req_v2 request;
+        } message;
+        memset(&message, 0, sizeof(message));
+        message.header.nlmsg_len = sizeof(message);
+        message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+        message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        message.request.sdiag_family = family;
+        message.request.sdiag_protocol = IPPROTO_TCP;
+        message.request.idiag_states = ~0u;
+        message.request.idiag_ext = 1 << (INET_DIAG_INFO - 1); // ask for tcp_info with each socket
+        struct sockaddr_nl kernel;
+        memset(&kernel, 0, sizeof(kernel));
+        kernel.nl_family = AF_NETLINK;
+        if (sendto(fd, &message, sizeof(message), 0, (struct sockaddr*)&kernel, sizeof(kernel)) < 0) return false;
+
+        bool found = false;
+        long buffer[4096]; // aligned for nlmsghdr
+        for (;;) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) return found;
+            int left = (int)n;
+            for (struct nlmsghdr* h = (struct nlmsghdr*)buffer; NLMSG_OK(h, left); h = NLMSG_NEXT(h, left)) {
+                if (h->nlmsg_type == NLMSG_DONE || h->nlmsg_type == NLMSG_ERROR) return found;
+                auto* diag = (struct inet_diag_msg*)NLMSG_DATA(h);
+                if (!std::binary_search(inodes.begin(), inodes.end(), (uint64_t)diag->idiag_inode)) continue; // someone else's
+                found = true;
+                int attr_len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*diag));
+                for (struct rtattr* attr = (struct rtattr*)(diag + 1); RTA_OK(attr, attr_len); attr = RTA_NEXT(attr, attr_len)) {
+                    if (attr->rta_type != INET_DIAG_INFO) continue;
+                    struct tcp_info info;
+                    memset(&info, 0, sizeof(info));
+                    memcpy(&info, RTA_DATA(attr), std::min(sizeof(info), (size_t)RTA_PAYLOAD(attr))); // older kernels send less
+                    bytes += info.tcpi_bytes_acked + info.tcpi_bytes_received;
+                }
+            }
+        }
+    }
+};
+
+// keeps the GGUF in memory between launches, so a restart reads its weights from RAM and not the SD card or NFS.
+// warm reads the file through the page cache once and asks for readahead again before every relaunch, pin
+// mlocks it. either runs on its own thread. staging copies the file into a directory (tmpfs) first, and by default
+// the copy stays there when the supervisor exits so the next run starts from it; unstage() removes it instead
+class ModelCache {
+public:
+    ~ModelCache() { stop(); }
+
+    // a copy in dir if there is room for it, reused if an earlier run left one. returns the path to launch with
+    std::string stage(const std::string& source, const std::string& dir) {
+        struct stat st;
+        if (stat(source.c_str(), &st) != 0) return source;
+        std::string name = source.substr(source.rfind('/') + 1);
+        std::string target = dir + "/" + name;
+        struct stat existing;
+        if (stat(target.c_str(), &existing) == 0 && existing.st_size == st.st_size && existing.st_mtime >= st.st_mtime) {
+            event_log.emit("model_staged").field("path", target).field("bytes", (uint64_t)st.st_size).field("reused", true);
+            staged = target;
+            return target;
+        }
+        struct statvfs fs;
+        if (statvfs(dir.c_str(), &fs) != 0 || (uint64_t)fs.f_bavail * fs.f_frsize < (uint64_t)st.st_size + STAGE_HEADROOM) {
+            event_log.emit("model_stage_skipped").field("dir", dir).field("bytes", (uint64_t)st.st_size).field("reason", "no room");
+            return source;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        std::string partial = dir + "/." + name + ".partial"; // renamed into place once complete
+        int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        int out = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = in >= 0 && out >= 0;
+        for (off_t offset = 0; ok && offset < st.st_size;) { // in-kernel copy, no buffer of ours in between
+            ssize_t n = sendfile(out, in, &offset, std::min<off_t>(st.st_size - offset, 1 << 30));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) ok = false;
+        }
+        if (!ok) log_error(("stage " + source).c_str());
+        if (in >= 0) close(in);
+        if (out >= 0) close(out);
+        if (!ok || rename(partial.c_str(), target.c_str()) != 0) {
+            unlink(partial.c_str());
+            return source;
+        }
+        event_log.emit("model_staged").field("path", target).field("bytes", (uint64_t)st.st_size)
+            .field("seconds", std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+        staged = target;
+        return target;
+    }
+
+    void unstage() { // orderly shutdown with --dl-model-stage-keep 0, after every child that mapped it is gone
+        if (staged.empty()) return;
+        if (unlink(staged.c_str()) != 0 && errno != ENOENT) log_error(("unlink " + staged).c_str());
+        else event_log.emit("model_unstaged").field("path", staged);
+        staged.clear();
+    }
+
+    void start(const std::string& model, const std::string& cache_mode) {
+        if (cache_mode == "off") return;
+        fd = open(model.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            log_error(("open " + model).c_str());
+            return;
+        }
+        size = st.st_size;
+        uint64_t ram = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+        if (size > ram * 3 / 4) { // would only push out the pages llama-cli itself needs
+            event_log.emit("model_cache_skipped").field("path", model).field("bytes", (uint64_t)size).field("ram", ram);
+            close(fd);
+            fd = -1;
+            return;
+        }
+        path = model;
+        mode = cache_mode;
+        running = true;
+        worker = std::thread([this] { run(); });
+    }
+
+    void rewarm() { // before a relaunch; the worker only asks the kernel for pages it has dropped since
+        if (!worker.joinable()) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        rewarm_pending = true;
+        cv.notify_one();
+    }
+
+    void stop() {
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                running = false;
+            }
+            cv.notify_one();
+            worker.join();
+        }
+        if (map != MAP_FAILED) munmap(map, size);
+        map = MAP_FAILED;
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+
+private:
+    static constexpr size_t CHUNK = 64 << 20; // between checks for stop()
+    static constexpr uint64_t STAGE_HEADROOM = 256ULL << 20; // left free in the stage directory
+
+    std::string path;
+    std::string mode;
+    std::string staged; // the copy stage() handed out, empty if none
+    int fd = -1;
+    size_t size = 0;
+    void* map = MAP_FAILED; // pin only
+    std::thread worker;
+    std::mutex mtx; // guards running and rewarm_pending
+    std::condition_variable cv;
+    bool running = false;
+    bool rewarm_pending = false;
+
+    bool still_running() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return running;
+    }
+
+    void run() {
+        auto started = std::chrono::steady_clock::now();
+        bool locked = mode == "pin" && pin();
+        if (!locked) read_through();
+        event_log.emit("model_cached").field("path", path).field("mode", mode).field("locked", locked).field("bytes", (uint64_t)size)
+            .field("seconds", std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+
+        std::unique_lock<std::mutex> lock(mtx);
+        while (running) {
+            cv.wait(lock, [this] { return !running || rewarm_pending; });
+            if (!running) break;
+            rewarm_pending = false;
+            if (locked) continue; // nothing to bring back
+            lock.unlock();
+            posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED); // async readahead, cached pages cost nothing
+            lock.lock();
+        }
+    }
+
+    bool pin() { // mmap and mlock in chunks, falls back to warm if the memlock limit says no
+        map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            log_error(("mmap " + path).c_str());
+            return false;
+        }
+        for (size_t offset = 0; offset < size && still_running(); offset += CHUNK) {
+            if (mlock((char*)map + offset, std::min(CHUNK, size - offset)) != 0) {
+                log_error("mlock"); // RLIMIT_MEMLOCK, usually
+                munmap(map, size);
+                map = MAP_FAILED;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void read_through() { // pread rather than a hint, so the pages are really in when this returns
+        std::vector<char> buffer(1 << 20);
+        for (size_t offset = 0; offset < size && still_running();) {
+            size_t end = std::min(size, offset + CHUNK);
+            while (offset < end) {
+                ssize_t n = pread(fd, buffer.data(), std::min(buffer.size(), end - offset), offset);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return;
+                offset += n;
+            }
+        }
+    }
+};
+
+struct LayerRange { // contiguous block of layers on one server, absolute layer indices with the output layer last
+    size_t server;
+    int first;
+    int count;
+};
+
+struct LaunchPlan { // topology and layer placement for one llama-cli launch
+    std::string rpc; // --rpc list, empty for the CPU fallback
+    int ngl = 0;
+    std::string tensor_split; // per-server layer counts, empty to leave the split to llama.cpp
+    std::vector<LayerRange> placement; // what each server ends up holding, empty while n_layer is unknown
+    int level = 0; // rung of the degradation ladder, 0 for the command line as given
+    int capped_from = 0; // layers that didn't fit when memory capped -ngl, 0 if everything did
+};
+
+class ResumeTracker { // follows what llama-cli has generated so a restart can carry on from there
+public:
+    std::string prompt; // original prompt text
+
+    // new process: echoes_prompt is false for resumed launches, which run with --no-display-prompt.
+    // the load log is on stderr, so stdout starts with the echo
+    void start_process(bool echoes_prompt) {
+        state = LEADING;
+        expect_echo = echoes_prompt;
+        echo.clear();
+    }
+
+    void on_output(const char* data, size_t n) {
+        size_t before = text.size();
+        for (size_t i = 0; i < n; i++) {
+            char c = data[i];
+            switch (state) {
+                case LEADING: // blank log lines between the marker and the text
+                    if (c == '\n' || (expect_echo && isspace((unsigned char)c))) break;
+                    state = expect_echo ? ECHO : TEXT;
+                    i--; // look at this byte again in the new state
+                    break;
+                case ECHO: // the prompt being played back
+                    echo += c;
+                    if (echo.size() == trimmed_prompt().size()) {
+                        if (echo != trimmed_prompt()) {
+                            broken = true; // tokenizer round trip changed the text, can't splice safely
+                            event_log.emit("resume_disabled").field("reason", "prompt echo didn't match the prompt");
+                        }
+                        state = TEXT;
+                    }
+                    break;
+                case TEXT:
+                    if (!broken) text += c;
+                    break;
+            }
+        }
+        if (text.size() > before) tokens++; // llama-cli flushes once per token, and a packet pipe reads one write at a time
+    }
+
+    bool usable() const { return !broken && !prompt.empty(); }
+    const std::string& generated() const { return text; }
+    // exact while the child writes each token with one write() into a packet pipe, a lower bound otherwise
+    size_t generated_tokens() const { return tokens; }
+
+private:
+    enum State { LEADING, ECHO, TEXT };
+    State state = LEADING;
+    bool expect_echo = true;
+    bool broken = false;
+    std::string echo;
+    std::string text; // everything generated so far, across processes
+    size_t tokens = 0;
+
+    std::string trimmed_prompt() const { // llama-cli may drop leading whitespace when it plays the prompt back
+        size_t start = prompt.find_first_not_of(" \t\r\n");
+        return start == std::string::npos ? "" : prompt.substr(start);
+    }
+};
+
+// bound and listening TCP socket for host:port, :port or port, IPv4 like the rpc side. -1 on failure
+static int listen_on(const std::string& address, int flags = 0) {
+    std::string host = "0.0.0.0";
+    std::string port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        if (colon > 0) host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(std::atoi(port.c_str()));
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        event_log.emit("listen_failed").field("address", address).field("error", "not an IPv4 address");
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | flags, 0);
+    int one = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        log_error(("listen on " + address).c_str());
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const char* data, size_t size) { // sockets only, no SIGPIPE for a peer that left
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+struct BackendAddress { // where the proxy sends requests, and which launch that is
+    std::string host;
+    int port = 0;
+    uint64_t generation = 0;
+    sockaddr_storage addr{}; // host resolved, port set; len 0 if the name hasn't resolved
+    socklen_t len = 0;
+};
+
+// HTTP front end for server mode: clients talk to us, we forward to llama-server and replay what a restart cut off
+class RequestProxy {
+public:
+    explicit RequestProxy(const SupervisorConfig& config)
+        : config(config), listen_fd(-1), idle_fd(-1), running(false), started(false) {}
+
+    ~RequestProxy() { stop(); }
+
+    // an empty address routes submit() only: no socket and no workers of its own
+    bool start(const std::string& address, int backends) {
+        if (!address.empty()) {
+            listen_fd = listen_on(address, SOCK_NONBLOCK); // accepted from the event loop
+            if (listen_fd < 0) return false;
+        }
+
+        slots.assign(backends, Slot());
+        running = true;
+        started = true;
+        if (address.empty()) return true;
+        for (int i = 0; i < config.proxy_inflight; i++) { // one worker per request the backend may have in flight
+            workers.emplace_back(&RequestProxy::worker_loop, this);
+        }
+        return true;
+    }
+
+    int fd() const { return listen_fd; }
+    bool enabled() const { return started; } // routing requests, with or without a listen socket
+
+    // one request from inside the supervisor, with the same routing and replays as a client's. false if it
+    // never got answered; response is the raw HTTP answer either way
+    bool submit(const std::string& request, std::string& response) {
+        std::string error;
+        bool settled = relay(request, [&](const char* data, size_t n) {
+            response.append(data, n);
+            return true;
+        }, error);
+        if (!settled) response = error;
+        return settled;
+    }
+
+    void accept_pending() { // drain the listen backlog, called from the event loop
+        while (true) {
+            int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) log_error("proxy accept");
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            if (queue.size() >= (size_t)config.proxy_queue) { // shed load here rather than let latency grow without bound
+                lock.unlock();
+                send_status(client, 503, "request queue is full");
+                close(client);
+                continue;
+            }
+            queue.push_back(client);
+            lock.unlock();
+            queue_cv.notify_one();
+        }
+    }
+
+    void backend_ready(int index, const BackendAddress& backend) { // /health said 200, release held requests
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            slots[index].address = backend;
+            slots[index].ok = true;
+        }
+        backend_cv.notify_all();
+    }
+
+    void backend_down(int index) { // restart under way, route around it until the next backend_ready()
+        std::lock_guard<std::mutex> lock(mtx);
+        slots[index].ok = false;
+    }
+
+    // between requests: takes a backend that is up and has nothing in flight out of the rotation, so a restart
+    // right after cuts nobody off. false while it's serving or not up
+    bool claim_idle(int index) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!slots[index].ok || slots[index].outstanding > 0) return false;
+        slots[index].ok = false;
+        return true;
+    }
+
+    void notify_idle(int fd) { idle_fd = fd; } // eventfd poked when a backend's last request settles, -1 for none
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            running = false;
+            for (int fd : active) shutdown(fd, SHUT_RDWR); // wakes workers blocked on a client or the backend
+        }
+        queue_cv.notify_all();
+        backend_cv.notify_all();
+        for (auto& worker : workers) worker.join();
+        workers.clear();
+
+        for (int client : queue) {
+            send_status(client, 503, "supervisor is shutting down");
+            close(client);
+        }
+        queue.clear();
+        if (listen_fd >= 0) close(listen_fd);
+        listen_fd = -1;
+    }
+
+private:
+    const SupervisorConfig& config;
+    int listen_fd;
+    std::atomic<int> idle_fd;
+    std::vector<std::thread> workers;
+    std::mutex mtx; // guards everything below
+    std::condition_variable queue_cv;
+    std::condition_variable backend_cv;
+    bool running;
+    bool started; // main thread only
+    std::deque<int> queue; // accepted clients waiting for a worker
+    std::vector<int> active; // client and backend sockets in use, so stop() can shut them down
+
+    struct Slot { // one supervised backend as the router sees it
+        BackendAddress address;
+        bool ok = false; // answering /health
+        int outstanding = 0; // requests forwarded to it and not settled yet
+    };
+    std::vector<Slot> slots;
+
+    static constexpr int MAX_REPLAYS = 3; // a request that keeps killing the backend gets a 502 eventually
+    static constexpr int CLIENT_TIMEOUT_S = 30; // for reading the request, not for waiting on the answer
+    static constexpr int RETRY_GRACE_MS = 1000; // before retrying a backend that dropped us but still looks healthy
+    static constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+    static constexpr size_t MAX_BODY_BYTES = 64 * 1024 * 1024;
+
+    void track(int fd) {
+        std::lock_guard<std::mutex> lock(mtx);
+        active.push_back(fd);
+    }
+
+    void untrack(int fd) { // before close(), so stop() never shuts down a reused descriptor
+        std::lock_guard<std::mutex> lock(mtx);
+        active.erase(std::remove(active.begin(), active.end(), fd), active.end());
+    }
+
+    void worker_loop() {
+        while (true) {
+            int client;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                queue_cv.wait(lock, [this] { return !running || !queue.empty(); });
+                if (!running) return;
+                client = queue.front();
+                queue.pop_front();
+                active.push_back(client);
+            }
+            serve(client);
+            untrack(client);
+            close(client);
+        }
+    }
+
+    void serve(int client) {
+        struct timeval tv = {CLIENT_TIMEOUT_S, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        std::string request;
+        int status = read_request(client, request);
+        if (status == 0) return; // client went away or never finished sending
+        if (status != 200) {
+            send_status(client, status, "request rejected by the proxy");
+            return;
+        }
+
+        std::string error;
+        if (relay(request, [client](const char* data, size_t n) { return send_all(client, data, n); }, error)) return;
+        send_status(client, error == "backend unavailable" ? 503 : 502, error);
+    }
+
+    using Sink = std::function<bool(const char*, size_t)>; // false once whoever asked is gone
+
+    // the request is buffered whole, so it can be sent again as long as the sink has seen nothing yet.
+    // false with the reason if it never got an answer
+    bool relay(const std::string& request, const Sink& sink, std::string& error) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config.replay_timeout_ms);
+        uint64_t failed_generation = 0;
+        for (int attempt = 0; attempt <= MAX_REPLAYS; attempt++) {
+            BackendAddress target;
+            int slot = acquire_backend(failed_generation, target, deadline);
+            if (slot < 0) {
+                error = "backend unavailable";
+                return false;
+            }
+            bool settled = forward(request, sink, target);
+            release_backend(slot);
+            if (settled) return true;
+            failed_generation = target.generation;
+            if (attempt < MAX_REPLAYS) {
+                event_log.emit("request_replayed").field("attempt", attempt + 1).field("failed_generation", failed_generation);
+            }
+        }
+        error = "backend failed the request repeatedly";
+        return false;
+    }
+
+    // least outstanding requests among the backends that are up, and counts this one against it. the launch that
+    // just failed us only gets it again once it has stayed healthy past the grace period. -1 if nothing came up in time
+    int acquire_backend(uint64_t failed_generation, BackendAddress& target, std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto grace = std::chrono::steady_clock::now() + std::chrono::milliseconds(RETRY_GRACE_MS);
+        while (running) {
+            auto now = std::chrono::steady_clock::now();
+            int best = -1;
+            for (size_t i = 0; i < slots.size(); i++) {
+                if (!slots[i].ok || (slots[i].address.generation == failed_generation && now < grace)) continue;
+                if (best < 0 || slots[i].outstanding < slots[best].outstanding) best = (int)i;
+            }
+            if (best >= 0) {
+                slots[best].outstanding++;
+                target = slots[best].address;
+                return best;
+            }
+            if (now >= deadline) return -1;
+            backend_cv.wait_until(lock, now < grace ? std::min(grace, deadline) : deadline);
+        }
+        return -1;
+    }
+
+    void release_backend(int slot) {
+        std::lock_guard<std::mutex> lock(mtx);
+        int fd = idle_fd;
+        if (--slots[slot].outstanding == 0 && fd >= 0) {
+            uint64_t one = 1;
+            if (write(fd, &one, sizeof(one)) < 0) log_error("eventfd write");
+        }
+    }
+
+    // true if the request is settled (answered, cut off after the client saw bytes, or the client left),
+    // false if the backend failed before anything reached the client and a replay is safe
+    bool forward(const std::string& request, const Sink& sink, const BackendAddress& target) {
+        int fd = target.len > 0 ? socket(target.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+        if (fd < 0 || connect(fd, (const struct sockaddr*)&target.addr, target.len) < 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        track(fd);
+
+        bool sent_any = false;
+        bool client_gone = false;
+        if (send_all(fd, request.data(), request.size())) {
+            char buffer[64 * 1024];
+            while (true) { // no timeout here, a wedged backend is the supervisor's to restart and that closes us
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break; // end of the answer with Connection: close, or the backend died
+                sent_any = true;
+                if (!sink(buffer, n)) {
+                    client_gone = true;
+                    break;
+                }
+            }
+        }
+        untrack(fd);
+        close(fd);
+        return sent_any || client_gone;
+    }
+
+    // 200 with the request rewritten for a single exchange, 0 if there's no one left to answer, else the error status
+    static int read_request(int client, std::string& request) {
+        std::string data;
+        char buffer[8192];
+        size_t header_end;
+        while ((header_end = data.find("\r\n\r\n")) == std::string::npos) {
+            if (data.size() > MAX_HEADER_BYTES) return 431;
+            ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return 0;
+            data.append(buffer, n);
+        }
+
+        std::istringstream lines(data.substr(0, header_end));
+        std::string line;
+        std::string head;
+        size_t content_length = 0;
+        bool first = true;
+        while (std::getline(lines, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (first) { // request line goes through untouched
+                head = line + "\r\n";
+                first = false;
+                continue;
+            }
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) return 400;
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name == "transfer-encoding") return 411; // we need the whole body up front to replay it
+            if (name == "content-length") content_length = std::strtoull(line.c_str() + colon + 1, nullptr, 10);
+            if (name == "connection" || name == "keep-alive" || name == "proxy-connection") continue;
+            head += line + "\r\n";
+        }
+        if (head.empty()) return 400;
+        if (content_length > MAX_BODY_BYTES) return 413;
+        head += "Connection: close\r\n\r\n"; // one request per connection, end of answer is end of stream
+
+        std::string body = data.substr(header_end + 4);
+        while (body.size() < content_length) {
+            ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return 0;
+            body.append(buffer, n);
+        }
+        body.resize(content_length);
+        request = head + body;
+        return 200;
+    }
+
+    static void send_status(int client, int status, const std::string& message) {
+        const char* reason = status == 400 ? "Bad Request" : status == 411 ? "Length Required" :
+                             status == 413 ? "Payload Too Large" : status == 431 ? "Request Header Fields Too Large" :
+                             status == 502 ? "Bad Gateway" : "Service Unavailable";
+        std::string body = "{\"error\":\"" + message + "\"}";
+        std::string response = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n"
+                               "Content-Type: application/json\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        if (status == 503) response += "Retry-After: 1\r\n";
+        response += "Connection: close\r\n\r\n" + body;
+        send_all(client, response.data(), response.size());
+    }
+};
+
+// just enough JSON to pick top-level members out of a job or a result line, values come back as raw text
+static size_t json_skip_space(const std::string& s, size_t i) {
+    while (i < s.size() && isspace((unsigned char)s[i])) i++;
+    return i;
+}
+
+static size_t json_skip_value(const std::string& s, size_t i) { // index just past the value starting at i
+    if (i >= s.size()) return i;
+    if (s[i] != '"' && s[i] != '{' && s[i] != '[') {
+        while (i < s.size() && !strchr(",}] \t\r\n", s[i])) i++;
+        return i;
+    }
+    int depth = 0;
+    bool in_string = false;
+    for (; i < s.size(); i++) {
+        char c = s[i];
+        if (in_string) {
+            if (c == '\\') i++;
+            else if (c == '"') {
+                in_string = false;
+                if (depth == 0) return i + 1;
+            }
+        } else if (c == '"') {
+            in_string = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if ((c == '}' || c == ']') && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return i;
+}
+
+static bool json_member(const std::string& object, const std::string& key, std::string& raw) {
+    size_t i = json_skip_space(object, 0);
+    if (i >= object.size() || object[i] != '{') return false;
+    i++;
+    while (true) {
+        i = json_skip_space(object, i);
+        if (i >= object.size() || object[i] != '"') return false;
+        size_t key_end = json_skip_value(object, i);
+        std::string name = object.substr(i + 1, key_end - i - 2); // escapes left as they are, keys we look for have none
+        i = json_skip_space(object, key_end);
+        if (i >= object.size() || object[i] != ':') return false;
+        i = json_skip_space(object, i + 1);
+        size_t value_end = json_skip_value(object, i);
+        if (name == key) {
+            raw = object.substr(i, value_end - i);
+            return true;
+        }
+        i = json_skip_space(object, value_end);
+        if (i >= object.size() || object[i] != ',') return false;
+        i++;
+    }
+}
+
+// a queue of prompts run through the proxy as if they were clients, each finished job appended to a JSON lines
+// file that's synced before the next result goes in. a rerun against the same file skips what already succeeded,
+// so a crash or a failover costs the jobs that were in flight and nothing else
+class BatchRunner {
+public:
+    BatchRunner() : total(0), skipped(0), succeeded(0), failed(0), out_fd(-1), wake_fd(-1), running(false), finished(false) {}
+
+    ~BatchRunner() { join(); }
+
+    // jobs from a file (a line each, a JSON request body or a plain prompt) or a directory (a file each)
+    bool start(const std::string& path, const std::string& out_path, int workers, RequestProxy& proxy, int wake) {
+        std::vector<Job> all;
+        if (!load_jobs(path, all)) return false;
+        std::set<std::string> done;
+        if (!open_results(out_path, done)) return false;
+
+        for (auto& job : all) {
+            if (done.count(job.id)) {
+                skipped++;
+                continue;
+            }
+            pending.push_back(std::move(job));
+        }
+        total = all.size();
+        event_log.emit("batch_started").field("path", path).field("results", out_path).field("jobs", total.load())
+            .field("skipped", skipped.load());
+
+        this->proxy = &proxy;
+        wake_fd = wake;
+        running = true;
+        outstanding = pending.size();
+        if (outstanding == 0) finish();
+        for (int i = 0; i < workers && i < (int)pending.size(); i++) threads.emplace_back(&BatchRunner::worker_loop, this);
+        return true;
+    }
+
+    bool is_finished() const { return finished; }
+    size_t jobs() const { return total; }
+    size_t jobs_skipped() const { return skipped; }
+    size_t jobs_succeeded() const { return succeeded; }
+    size_t jobs_failed() const { return failed; }
+
+    void stop() { // before the proxy stops, so an answer cut short by the shutdown isn't recorded as a result
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            running = false;
+        }
+        queue_cv.notify_all();
+    }
+
+    void join() { // after the proxy stops, which is what unblocks workers still waiting on an answer
+        stop();
+        for (auto& thread : threads) thread.join();
+        threads.clear();
+        if (out_fd >= 0) close(out_fd);
+        out_fd = -1;
+    }
+
+private:
+    struct Job {
+        std::string id; // raw JSON: the job's own "id", its line number, or its file name as a string
+        std::string body; // the request body
+        std::string endpoint;
+        int attempts = 0;
+    };
+
+    static constexpr int MAX_ATTEMPTS = 5; // answered with a 5xx or never answered, then it's recorded as failed
+
+    RequestProxy* proxy = nullptr;
+    std::atomic<size_t> total, skipped, succeeded, failed;
+    int out_fd;
+    int wake_fd;
+    std::vector<std::thread> threads;
+    std::mutex mtx; // guards everything below, and appends to out_fd
+    std::condition_variable queue_cv;
+    std::deque<Job> pending;
+    size_t outstanding = 0; // jobs not recorded yet, queued or in flight
+    bool running;
+    std::atomic<bool> finished;
+
+    static bool make_job(const std::string& text, const std::string& fallback_id, Job& job) {
+        size_t start = json_skip_space(text, 0);
+        if (start >= text.size()) return false;
+        if (text[start] == '{') { // a request body of its own, passed through as written
+            job.body = text.substr(start);
+            while (!job.body.empty() && isspace((unsigned char)job.body.back())) job.body.pop_back();
+            if (!json_member(job.body, "id", job.id)) job.id = fallback_id;
+            std::string messages;
+            job.endpoint = json_member(job.body, "messages", messages) ? "/v1/chat/completions" : "/completion";
+        } else {
+            std::string prompt = text;
+            while (!prompt.empty() && (prompt.back() == '\n' || prompt.back() == '\r')) prompt.pop_back();
+            job.body = "{\"prompt\":";
+            append_json_string(job.body, prompt);
+            job.body += "}";
+            job.id = fallback_id;
+            job.endpoint = "/completion";
+        }
+        return true;
+    }
+
+    static bool load_jobs(const std::string& path, std::vector<Job>& jobs) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            log_error(("batch " + path).c_str());
+            return false;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            DIR* dir = opendir(path.c_str());
+            if (!dir) {
+                log_error(("batch " + path).c_str());
+                return false;
+            }
+            std::vector<std::string> names;
+            while (struct dirent* entry = readdir(dir)) {
+                if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+            }
+            closedir(dir);
+            std::sort(names.begin(), names.end()); // same order every run
+            for (const auto& name : names) {
+                std::ifstream file(path + "/" + name, std::ios::binary);
+                if (!file) continue; // subdirectories and the like
+                std::stringstream text;
+                text << file.rdbuf();
+                std::string id;
+                append_json_string(id, name);
+                Job job;
+                if (make_job(text.str(), id, job)) jobs.push_back(std::move(job));
+            }
+            return true;
+        }
+
+        std::ifstream file(path);
+        if (!file) {
+            log_error(("batch " + path).c_str());
+            return false;
+        }
+        std::string line;
+        for (int number = 1; std::getline(file, line); number++) {
+            Job job;
+            if (make_job(line, std::to_string(number), job)) jobs.push_back(std::move(job));
+        }
+        return true;
+    }
+
+    // ids that already got a 200, from whole lines only: a line cut short by a crash mid-write is left out
+    // and its job runs again
+    bool open_results(const std::string& out_path, std::set<std::string>& done) {
+        std::ifstream existing(out_path, std::ios::binary);
+        bool needs_newline = false;
+        if (existing) {
+            std::stringstream text;
+            text << existing.rdbuf();
+            std::string data = text.str();
+            needs_newline = !data.empty() && data.back() != '\n';
+            size_t start = 0, end;
+            while ((end = data.find('\n', start)) != std::string::npos) {
+                std::string line = data.substr(start, end - start), id, status;
+                if (json_member(line, "id", id) && json_member(line, "status", status) && status == "200") done.insert(id);
+                start = end + 1;
+            }
+        }
+
+        out_fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (out_fd < 0) {
+            log_error(("batch results " + out_path).c_str());
+            return false;
+        }
+        if (needs_newline && write(out_fd, "\n", 1) < 0) log_error("batch results write"); // end the torn line
+        return true;
+    }
+
+    void worker_loop() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                queue_cv.wait(lock, [this] { return !running || !pending.empty(); });
+                if (!running) return;
+                job = std::move(pending.front());
+                pending.pop_front();
+            }
+            job.attempts++;
+
+            std::string request = "POST " + job.endpoint + " HTTP/1.1\r\nHost: durable-llama\r\n"
+                                  "Content-Type: application/json\r\nContent-Length: " + std::to_string(job.body.size()) +
+                                  "\r\nConnection: close\r\n\r\n" + job.body;
+            std::string response;
+            bool answered = proxy->submit(request, response);
+            int status = 0;
+            std::string body;
+            if (answered && !parse_response(response, status, body)) status = 0; // cut off partway through
+            if (!answered) body = response; // the proxy's reason
+
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!running) return; // shutting down, whatever came back may be a torn answer
+            if ((status == 0 || status >= 500) && job.attempts < MAX_ATTEMPTS) {
+                event_log.emit("batch_job_retried").field("id", job.id).field("attempt", job.attempts).field("status", status);
+                pending.push_back(std::move(job)); // to the back, the backend may need a moment
+                lock.unlock();
+                queue_cv.notify_one();
+                continue;
+            }
+            record(job, status, body);
+        }
+    }
+
+    // status and body of a whole answer, false if the backend died before all of Content-Length arrived
+    static bool parse_response(const std::string& response, int& status, std::string& body) {
+        size_t header_end = response.find("\r\n\r\n");
+        if (header_end == std::string::npos || response.compare(0, 5, "HTTP/") != 0) return false;
+        size_t space = response.find(' ');
+        if (space == std::string::npos || space > header_end) return false;
+        status = atoi(response.c_str() + space + 1);
+        body = response.substr(header_end + 4);
+
+        std::string headers = response.substr(0, header_end);
+        std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+        size_t length = headers.find("\r\ncontent-length:");
+        if (length != std::string::npos && body.size() < std::strtoull(headers.c_str() + length + 17, nullptr, 10)) return false;
+        return true;
+    }
+
+    void record(const Job& job, int status, const std::string& body) { // caller holds mtx
+        std::string line = "{\"id\":" + job.id + ",\"status\":" + std::to_string(status) +
+                           ",\"attempts\":" + std::to_string(job.attempts) + ",\"response\":";
+        size_t start = json_skip_space(body, 0);
+        if (start < body.size() && (body[start] == '{' || body[start] == '[')) { // llama-server's JSON as it is
+            std::string trimmed = body.substr(start);
+            while (!trimmed.empty() && isspace((unsigned char)trimmed.back())) trimmed.pop_back();
+            line += trimmed;
+        } else {
+            append_json_string(line, body); // streamed answers and the proxy's own errors
+        }
+        line += "}\n";
+
+        // one write per line so only a crash can tear one, and synced before the job counts as done
+        if (write(out_fd, line.data(), line.size()) != (ssize_t)line.size()) log_error("batch results write");
+        if (fdatasync(out_fd) < 0) log_error("batch results fdatasync");
+        (status == 200 ? succeeded : failed)++;
+        event_log.emit("batch_job_done").field("id", job.id).field("status", status).field("attempts", job.attempts);
+        if (--outstanding == 0) finish();
+    }
+
+    void finish() {
+        event_log.emit("batch_finished").field("jobs", total.load()).field("skipped", skipped.load())
+            .field("succeeded", succeeded.load()).field("failed", failed.load());
+        finished = true;
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) log_error("eventfd write"); // the event loop shuts us down
+    }
+};
+
+enum class RestartReason { // why a run ended, and so why its backend was (re)started
+    START, // first launch, nothing ended
+    STALLED, // no output within the phase limit
+    EXIT, // non-zero exit status
+    SIGNAL, // killed by a signal
+    UNREACHABLE, // an rpc server in its pool went away
+    HEALTH, // llama-server stopped answering /health
+    READMIT, // restarted to take a recovered server back
+    COMPLETED, // llama-cli finished, no restart
+    SHUTDOWN // we were asked to stop, no restart
+};
+
+static const char* restart_reason_name(RestartReason reason) {
+    switch (reason) {
+        case RestartReason::START: return "start";
+        case RestartReason::STALLED: return "stalled";
+        case RestartReason::EXIT: return "exit";
+        case RestartReason::SIGNAL: return "signal";
+        case RestartReason::UNREACHABLE: return "unreachable";
+        case RestartReason::HEALTH: return "health";
+        case RestartReason::READMIT: return "readmit";
+        case RestartReason::COMPLETED: return "completed";
+        case RestartReason::SHUTDOWN: return "shutdown";
+    }
+    return "unknown";
+}
+
+class LatencyHistogram { // geometric buckets from 0.5 ms to about a minute, percentiles interpolated inside a bucket
+public:
+    static constexpr int BUCKETS = 30;
+    static constexpr double FIRST_MS = 0.5;
+    static constexpr double GROWTH = 1.5;
+
+    static double upper_ms(int bucket) { return FIRST_MS * std::pow(GROWTH, bucket); } // the last bucket is open-ended
+
+    void add(double ms) {
+        int bucket = ms <= FIRST_MS ? 0 : (int)std::ceil(std::log(ms / FIRST_MS) / std::log(GROWTH));
+        counts[std::min(bucket, BUCKETS - 1)]++;
+        total++;
+        sum_ms += ms;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) counts[i] += other.counts[i];
+        total += other.total;
+        sum_ms += other.sum_ms;
+    }
+
+    double percentile(double q) const {
+        if (total == 0) return 0;
+        double rank = q * total;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            if (counts[i] > 0 && seen + counts[i] >= rank) {
+                double lo = i > 0 ? upper_ms(i - 1) : 0;
+                return lo + (upper_ms(i) - lo) * (rank - seen) / counts[i];
+            }
+            seen += counts[i];
+        }
+        return upper_ms(BUCKETS - 1);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t bucket_count(int bucket) const { return counts[bucket]; }
+    double sum() const { return sum_ms; }
+
+private:
+    uint64_t counts[BUCKETS] = {};
+    uint64_t total = 0;
+    double sum_ms = 0;
+};
+
+struct RunStats { // one process from spawn to exit
+    bool active = false;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point loaded; // load marker, or /health 200 in server mode
+    std::chrono::steady_clock::time_point first_output; // first generated text
+    std::chrono::steady_clock::time_point last_output;
+    bool load_done = false;
+    bool generating = false;
+    uint64_t chunks = 0; // output events while generating, about one token each, fewer when they queue up
+    uint64_t bytes = 0;
+    LatencyHistogram itl; // gaps between those events
+    long perf_tokens = -1; // llama.cpp's own "eval time = ... / N runs", when we get to see it
+    double perf_ms = 0;
+    int load_percent = -1; // from its progress dots, -1 until the first one
+
+    static double seconds(std::chrono::steady_clock::duration d) { return std::chrono::duration<double>(d).count(); }
+
+    double load_s() const { return load_done ? seconds(loaded - started) : 0; }
+    double ttft_s() const { return generating ? seconds(first_output - loaded) : 0; } // prompt eval plus the first token
+    double generation_s() const {
+        if (perf_tokens > 0) return perf_ms / 1000;
+        return generating ? seconds(last_output - first_output) : 0;
+    }
+    uint64_t tokens() const { return perf_tokens > 0 ? perf_tokens : chunks; }
+    double tokens_per_s() const {
+        double s = generation_s();
+        return s > 0 ? tokens() / s : 0;
+    }
+};
+
+// load time, time to first token, throughput and inter-token latency per run, restarts and the downtime each
+// failover cost. printed as each run ends and summed at exit. fed from the main loop only
+class RunMetrics {
+public:
+    void resize(size_t backends) {
+        current.assign(backends, RunStats());
+        down_since.assign(backends, std::chrono::steady_clock::time_point());
+        down.assign(backends, false);
+    }
+
+    void start_run(size_t b, std::chrono::steady_clock::time_point now, bool loaded = false) {
+        current[b] = RunStats();
+        current[b].active = true;
+        current[b].started = now;
+        if (loaded) { // a warm standby taking over
+            current[b].load_done = true;
+            current[b].loaded = now;
+        }
+    }
+
+    bool active(size_t b) const { return current[b].active; }
+
+    void on_output(size_t b, RunPhase before, RunPhase after, size_t n, std::chrono::steady_clock::time_point now) {
+        auto& run = current[b];
+        if (!run.active) return;
+        if (before == RunPhase::LOAD && after != RunPhase::LOAD) {
+            run.load_done = true;
+            run.loaded = now;
+        }
+        if (after != RunPhase::GENERATION) return;
+        if (!run.generating) {
+            run.generating = true;
+            run.first_output = now;
+            back_in_service(b, now);
+        } else {
+            run.itl.add(std::chrono::duration<double, std::milli>(now - run.last_output).count());
+        }
+        run.chunks++;
+        run.bytes += n;
+        run.last_output = now;
+    }
+
+    void on_load_done(size_t b, std::chrono::steady_clock::time_point now) { // load marker on stderr
+        auto& run = current[b];
+        if (!run.active || run.load_done) return;
+        run.load_done = true;
+        run.loaded = now;
+    }
+
+    void on_load_progress(size_t b, int percent) {
+        if (current[b].active) current[b].load_percent = percent;
+    }
+
+    void on_serving(size_t b, std::chrono::steady_clock::time_point now) { // llama-server answered /health
+        auto& run = current[b];
+        if (!run.active || run.load_done) return;
+        run.load_done = true;
+        run.loaded = now;
+        back_in_service(b, now);
+    }
+
+    void scan_perf(size_t b, const char* data, size_t n) { // llama_perf_context_print: eval time = 1234.56 ms / 99 runs
+        std::string chunk(data, n);
+        for (size_t pos = chunk.find("eval time ="); pos != std::string::npos; pos = chunk.find("eval time =", pos + 1)) {
+            if (pos >= 7 && chunk.compare(pos - 7, 7, "prompt ") == 0) continue;
+            double ms;
+            long runs;
+            if (sscanf(chunk.c_str() + pos + 11, " %lf ms / %ld", &ms, &runs) == 2 && runs > 0) {
+                current[b].perf_ms = ms;
+                current[b].perf_tokens = runs;
+            }
+        }
+    }
+
+    void end_run(size_t b, RestartReason reason, std::chrono::steady_clock::time_point now) {
+        auto& run = current[b];
+        if (!run.active) return;
+        run.active = false;
+        runs++;
+        if (reason != RestartReason::COMPLETED && reason != RestartReason::SHUTDOWN) {
+            restarts++;
+            restart_counts[(int)reason]++;
+            if (!down[b]) { // a restart that dies during load is still the same outage
+                down[b] = true;
+                down_since[b] = run.generating ? run.last_output : now; // the silence before a stall was lost time too
+            }
+        }
+        tokens += run.tokens();
+        generation_s += run.generation_s();
+        itl.merge(run.itl);
+
+        auto record = event_log.emit("run_end");
+        record.field("run", runs).field("pool", b).field("reason", restart_reason_name(reason));
+        if (!run.load_done) {
+            record.field("ended_during_load_s", RunStats::seconds(now - run.started));
+        } else {
+            record.field("load_s", run.load_s());
+            if (run.generating) {
+                record.field("ttft_s", run.ttft_s()).field("tokens", run.tokens()).field("tokens_per_s", run.tokens_per_s())
+                      .field("itl_p50_ms", run.itl.percentile(0.5)).field("itl_p99_ms", run.itl.percentile(0.99));
+            } else {
+                record.field("up_s", RunStats::seconds(now - run.loaded));
+            }
+        }
+    }
+
+    void log_totals() const {
+        if (runs == 0) return;
+        event_log.emit("totals").field("runs", runs).field("restarts", restarts).field("tokens", tokens)
+            .field("tokens_per_s", generation_s > 0 ? tokens / generation_s : 0.0)
+            .field("itl_p50_ms", itl.percentile(0.5)).field("itl_p99_ms", itl.percentile(0.99))
+            .field("downtime_s", downtime_s).field("failovers", failovers);
+    }
+
+    // cumulative counters, read by the main loop
+    uint64_t runs = 0;
+    uint64_t restarts = 0;
+    uint64_t restart_counts[(int)RestartReason::SHUTDOWN + 1] = {};
+    uint64_t tokens = 0;
+    double generation_s = 0;
+    LatencyHistogram itl;
+    uint64_t failovers = 0;
+    double downtime_s = 0; // from a run ending badly to the backend being useful again
+    double last_downtime_s = 0;
+    std::vector<RunStats> current; // per backend
+
+private:
+    std::vector<std::chrono::steady_clock::time_point> down_since;
+    std::vector<bool> down;
+
+    void back_in_service(size_t b, std::chrono::steady_clock::time_point now) {
+        if (!down[b]) return;
+        down[b] = false;
+        last_downtime_s = RunStats::seconds(now - down_since[b]);
+        downtime_s += last_downtime_s;
+        failovers++;
+        event_log.emit("back_in_service").field("pool", b).field("downtime_s", last_downtime_s);
+    }
+};
+
+// --dl-trace: where each failover's time went, as Chrome trace events (chrome://tracing or ui.perfetto.dev). an
+// incident runs from the first sign of trouble to the backend being useful again and gets a file of its own. the
+// supervisor's own steps, the replaced child's exit and the new child's load phases go on separate tracks. main loop only
+class FailoverTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void start(const std::string& trace_dir, size_t backends) {
+        dir = trace_dir;
+        incidents.assign(backends, Incident());
+    }
+
+    bool enabled() const { return !dir.empty(); }
+    bool open(size_t b) const { return enabled() && incidents[b].open; }
+
+    // no-op while one is open, a restart that dies during load is still the same outage
+    void begin(size_t b, const char* cause, Clock::time_point since) {
+        if (!enabled() || incidents[b].open) return;
+        Incident& incident = incidents[b];
+        incident = Incident();
+        incident.open = true;
+        incident.cause = cause;
+        incident.started = since;
+        incident.number = ++count;
+    }
+
+    void span(size_t b, const char* name, Clock::time_point start, Clock::time_point end, const std::string& args = "") {
+        if (open(b)) add(incidents[b], SUPERVISOR, name, start, end, args);
+    }
+
+    void instant(size_t b, const char* name, Clock::time_point at, const std::string& args = "") {
+        if (!open(b)) return;
+        Incident& incident = incidents[b];
+        std::string event = "{\"name\":\"" + std::string(name) + "\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" + std::to_string(b) +
+                            ",\"tid\":" + std::to_string(SUPERVISOR) + ",\"ts\":" + std::to_string(us(at));
+        if (!args.empty()) event += ",\"args\":{" + args + "}";
+        incident.events.push_back(event + "}");
+    }
+
+    void terminated(size_t b, pid_t pid) { // its SIGTERM-to-reaped wait shows up once reaped() sees it go
+        if (open(b) && pid > 0) incidents[b].dying.push_back(pid);
+    }
+
+    void reaped(pid_t pid, Clock::time_point since, Clock::time_point now, bool killed) {
+        for (auto& incident : incidents) {
+            auto it = std::find(incident.dying.begin(), incident.dying.end(), pid);
+            if (!incident.open || it == incident.dying.end()) continue;
+            incident.dying.erase(it);
+            add(incident, REAPER, killed ? "exit_after_sigkill" : "exit_after_sigterm", since, now,
+                "\"pid\":" + std::to_string(pid));
+            return;
+        }
+    }
+
+    void spawned(size_t b, pid_t pid, Clock::time_point now, bool loaded) { // loaded: a promoted standby
+        if (!open(b)) return;
+        Incident& incident = incidents[b];
+        close_child(incident, now);
+        incident.child = pid;
+        incident.phase = loaded ? PROMPT : EXEC;
+        incident.phase_started = now;
+    }
+
+    // the child's load log, cut at the lines llama.cpp prints between phases. stops looking once the load is done
+    void child_line(size_t b, const std::string& line, Clock::time_point now) {
+        if (!open(b) || incidents[b].phase >= CONTEXT) return;
+        Incident& incident = incidents[b];
+        int reached = incident.phase;
+        if (line.find("llama_context:") != std::string::npos || line.find("llama_new_context_with_model:") != std::string::npos ||
+            line.find("llama_init_from_model:") != std::string::npos) {
+            reached = CONTEXT;
+        } else if (line.find("load_tensors:") != std::string::npos) {
+            reached = std::max(reached, (int)UPLOAD);
+        } else {
+            reached = std::max(reached, (int)METADATA); // first thing it printed, the exec and startup are behind it
+        }
+        if (reached != incident.phase) next_phase(incident, (Phase)reached, now);
+    }
+
+    void loaded(size_t b, Clock::time_point now) {
+        if (open(b) && incidents[b].phase != PROMPT && incidents[b].phase != NONE) next_phase(incidents[b], PROMPT, now);
+    }
+
+    void in_service(size_t b, Clock::time_point now) { // first token, or /health 200 for a server
+        if (!open(b)) return;
+        Incident& incident = incidents[b];
+        close_child(incident, now);
+        write(b, incident, now, true);
+        incident = Incident();
+    }
+
+    void stop(Clock::time_point now) { // shutting down mid-outage, the data so far is still worth having
+        for (size_t b = 0; b < incidents.size(); b++) {
+            if (!incidents[b].open) continue;
+            close_child(incidents[b], now);
+            write(b, incidents[b], now, false);
+            incidents[b] = Incident();
+        }
+    }
+
+private:
+    enum Track { SUPERVISOR = 1, CHILD = 2, REAPER = 3 };
+    enum Phase { NONE, EXEC, METADATA, UPLOAD, CONTEXT, PROMPT };
+
+    struct Incident {
+        bool open = false;
+        const char* cause = "";
+        Clock::time_point started;
+        int number = 0;
+        std::vector<std::string> events; // trace events, JSON
+        std::vector<pid_t> dying; // replaced children not reaped yet
+        pid_t child = -1;
+        Phase phase = NONE;
+        Clock::time_point phase_started;
+        std::string slowest; // longest span so far, for the summary event
+        long long slowest_us = -1;
+    };
+
+    std::string dir;
+    std::vector<Incident> incidents; // per backend
+    int count = 0;
+
+    static long long us(Clock::time_point t) { // same clock and unit as the event log's ts_us
+        return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+    }
+
+    static const char* phase_name(Phase phase) {
+        switch (phase) {
+            case NONE: return "none";
+            case EXEC: return "exec_and_startup"; // posix_spawn returned, nothing on stderr yet
+            case METADATA: return "model_metadata"; // reading the gguf header and backends, up to load_tensors
+            case UPLOAD: return "tensor_upload"; // weights read and pushed to the rpc servers
+            case CONTEXT: return "context_init"; // KV cache and compute buffers, to the end of the load
+            case PROMPT: return "first_output"; // prompt (re-)eval for llama-cli, warmup until /health for a server
+        }
+        return "unknown";
+    }
+
+    void add(Incident& incident, Track track, const char* name, Clock::time_point start, Clock::time_point end,
+             const std::string& args) {
+        long long dur = std::max(0LL, us(end) - us(start));
+        std::string event = "{\"name\":\"" + std::string(name) + "\",\"ph\":\"X\",\"pid\":" +
+                            std::to_string(&incident - incidents.data()) + ",\"tid\":" + std::to_string(track) +
+                            ",\"ts\":" + std::to_string(us(start)) + ",\"dur\":" + std::to_string(dur);
+        if (!args.empty()) event += ",\"args\":{" + args + "}";
+        incident.events.push_back(event + "}");
+        if (dur > incident.slowest_us) {
+            incident.slowest_us = dur;
+            incident.slowest = name;
+        }
+    }
+
+    void next_phase(Incident& incident, Phase phase, Clock::time_point now) {
+        add(incident, CHILD, phase_name(incident.phase), incident.phase_started, now, "\"pid\":" + std::to_string(incident.child));
+        incident.phase = phase;
+        incident.phase_started = now;
+    }
+
+    void close_child(Incident& incident, Clock::time_point now) { // the current child's phase ends here, however it went
+        if (incident.phase == NONE) return;
+        next_phase(incident, NONE, now);
+    }
+
+    void write(size_t b, Incident& incident, Clock::time_point now, bool finished) {
+        std::string slowest = incident.slowest; // before the whole-incident span, which would always win
+        long long slowest_us = incident.slowest_us;
+        add(incident, SUPERVISOR, "incident", incident.started, now,
+            "\"cause\":\"" + std::string(incident.cause) + "\",\"finished\":" + (finished ? "true" : "false"));
+
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        std::string pool = std::to_string(b);
+        out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + pool + ",\"args\":{\"name\":\"pool " + pool + "\"}},\n";
+        const std::pair<Track, const char*> tracks[] = {{SUPERVISOR, "supervisor"}, {CHILD, "child"}, {REAPER, "replaced child"}};
+        for (const auto& track : tracks) {
+            out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pool + ",\"tid\":" + std::to_string(track.first) +
+                   ",\"args\":{\"name\":\"" + track.second + "\"}},\n";
+        }
+        for (size_t i = 0; i < incident.events.size(); i++) {
+            out += incident.events[i];
+            out += i + 1 < incident.events.size() ? ",\n" : "\n";
+        }
+        out += "]}\n";
+
+        std::string path = dir + "/failover-" + std::to_string(getpid()) + "-" + std::to_string(incident.number) + ".json";
+        std::string tmp = path + ".tmp";
+        std::ofstream file(tmp, std::ios::trunc);
+        file << out;
+        file.close();
+        if (!file || rename(tmp.c_str(), path.c_str()) != 0) {
+            log_error(("trace " + path).c_str());
+            unlink(tmp.c_str());
+            return;
+        }
+        auto record = event_log.emit("trace_written");
+        record.field("pool", b).field("path", path).field("cause", incident.cause).field("finished", finished)
+            .field("total_ms", std::max(0LL, us(now) - us(incident.started)) / 1000.0);
+        if (slowest_us >= 0) record.field("slowest", slowest).field("slowest_ms", slowest_us / 1000.0); // where to look first
+    }
+};
+
+// --dl-metrics: Prometheus text exposition on its own thread. it only calls render(), which works from
+// copies, so a slow or stuck scraper can't hold up token forwarding
+class MetricsServer {
+public:
+    ~MetricsServer() { stop(); }
+
+    bool start(const std::string& address, std::function<std::string()> render) {
+        listen_fd = listen_on(address);
+        if (listen_fd < 0) return false;
+        this->render = std::move(render);
+        running = true;
+        thread = std::thread(&MetricsServer::serve_loop, this);
+        return true;
+    }
+
+    bool enabled() const { return listen_fd >= 0; }
+
+    void stop() {
+        if (listen_fd < 0) return;
+        running = false;
+        shutdown(listen_fd, SHUT_RDWR); // wakes the blocking accept()
+        thread.join();
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+private:
+    int listen_fd = -1;
+    std::atomic<bool> running{false};
+    std::thread thread;
+    std::function<std::string()> render;
+
+    void serve_loop() { // one scrape at a time is plenty
+        while (running) {
+            int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (running) log_error("metrics accept");
+                return;
+            }
+            struct timeval tv = {2, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+            std::string request;
+            char buffer[4096];
+            while (request.find("\r\n\r\n") == std::string::npos && request.size() < sizeof(buffer) * 4) {
+                ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+                if (n <= 0) break;
+                request.append(buffer, n);
+            }
+            bool found = request.rfind("GET /metrics", 0) == 0 || request.rfind("GET / ", 0) == 0;
+            std::string body = found ? render() : "not found\n";
+            std::string response = std::string("HTTP/1.1 ") + (found ? "200 OK" : "404 Not Found") + "\r\n"
+                                   "Content-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                                   "Connection: close\r\n\r\n" + body;
+            send_all(client, response.data(), response.size());
+            close(client);
+        }
+    }
+};
+
+// a whole command line in one allocation, the strings back to back with an argv of pointers into them.
+// kept across launches and only rebuilt when what goes into it changes, nothing to free on any path
+class ArgvArena {
+public:
+    std::string key; // what it was built for, empty forces a rebuild
+
+    void clear() {
+        key.clear();
+        text.clear();
+        offsets.clear();
+    }
+
+    void add(const std::string& arg) {
+        offsets.push_back(text.size());
+        text += arg;
+        text += '\0';
+    }
+
+    bool empty() const { return offsets.empty(); }
+
+    char* const* argv() { // pointers are fixed up last, the buffer moves while it grows
+        pointers.clear();
+        for (size_t offset : offsets) pointers.push_back(&text[offset]);
+        pointers.push_back(nullptr); // null term for posix_spawn
+        return pointers.data();
+    }
+
+private:
+    std::string text;
+    std::vector<size_t> offsets;
+    std::vector<char*> pointers;
+};
+
+// children on their way out: SIGTERM first, SIGKILL once the grace period is up. nothing blocks on them,
+// the event loop reaps them on SIGCHLD while their replacement is already loading
+class Terminator {
+public:
+    Terminator(int grace_ms, bool groups) : grace_ms(grace_ms), groups(groups) {}
+
+    bool own_groups() const { return groups; } // spawn puts each child in its own process group
+
+    // pid, when it was told to go, when it was reaped, whether it took SIGKILL
+    std::function<void(pid_t, std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point, bool)> on_reaped;
+
+    void terminate(pid_t pid, const char* what) {
+        if (pid <= 0) return;
+        signal_child(pid, SIGTERM);
+        signal_child(pid, SIGCONT); // a stopped process only acts on SIGTERM once it runs again
+        dying.push_back({pid, what, std::chrono::steady_clock::now(), false});
+    }
+
+    void reap() { // collect whatever has exited, never waits
+        for (size_t i = 0; i < dying.size();) {
+            int status;
+            pid_t result = waitpid(dying[i].pid, &status, WNOHANG);
+            if (result == 0) {
+                i++;
+                continue;
+            }
+            auto now = std::chrono::steady_clock::now();
+            auto elapsed = now - dying[i].since;
+            if (on_reaped) on_reaped(dying[i].pid, dying[i].since, now, dying[i].killed);
+            event_log.emit("child_reaped").field("pid", dying[i].pid).field("what", dying[i].what).field("killed", dying[i].killed)
+                .field("after_ms", std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+            dying.erase(dying.begin() + i);
+        }
+    }
+
+    void escalate(std::chrono::steady_clock::time_point now) { // SIGKILL for anything past its grace period
+        for (auto& child : dying) {
+            if (child.killed || now < child.since + std::chrono::milliseconds(grace_ms)) continue;
+            signal_child(child.pid, SIGKILL);
+            child.killed = true;
+            event_log.emit("child_escalated").field("pid", child.pid).field("what", child.what).field("grace_ms", grace_ms);
+        }
+    }
+
+    bool holds(pid_t pid) const { // told to go and not reaped yet
+        return std::any_of(dying.begin(), dying.end(), [pid](const Dying& child) { return child.pid == pid; });
+    }
+
+    std::chrono::steady_clock::time_point deadline() const { // next escalation, max() if there is none
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        for (const auto& child : dying) {
+            if (!child.killed) deadline = std::min(deadline, child.since + std::chrono::milliseconds(grace_ms));
+        }
+        return deadline;
+    }
+
+    void drain() { // shutdown: the same escalation, polled, and bounded by twice the grace period
+        auto give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(2 * grace_ms + 100);
+        while (!dying.empty()) {
+            reap();
+            auto now = std::chrono::steady_clock::now();
+            if (now >= give_up) break; // stuck in D state, nothing left to send it
+            escalate(now);
+            if (!dying.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+private:
+    struct Dying {
+        pid_t pid;
+        const char* what; // backend or standby, for the log
+        std::chrono::steady_clock::time_point since;
+        bool killed;
+    };
+    std::vector<Dying> dying;
+    int grace_ms;
+    bool groups;
+
+    void signal_child(pid_t pid, int sig) {
+        kill(groups ? -pid : pid, sig); // the group takes anything llama-cli started along with it
+    }
+};
+
+struct Backend { // one llama-cli or llama-server process and the pool of rpc servers it runs on
+    int pool;
+    pid_t process; // PID of llamacpp
+    int out_fd; // read end of its stdout pipe, tokens only
+    int err_fd; // read end of its stderr pipe, the load log and perf prints
+    ChildLogParser log;
+    uint64_t load_bytes; // TCP bytes the process had moved at the last load progress check
+    bool load_sampled; // load_bytes is a real sample, not the 0 from before the process had sockets
+    StallDetector stall; // per-phase silence limits for the current process
+    std::string rpc; // --rpc list the running process was launched with, empty on CPU
+    int ngl; // -ngl it was launched with
+    std::string tensor_split; // --tensor-split we gave it, empty if llama.cpp split the layers itself
+    int level; // ladder rung it was launched on
+    bool degraded; // below rung 0, short of layers or on CPU
+    uint64_t kv_bytes; // KV cache llama.cpp reported on the rpc servers during this load
+    uint64_t compute_bytes; // largest compute buffer on one of them
+    int log_ctx; // n_ctx and n_ubatch from the load log, 0 until seen
+    int log_ubatch;
+    ArgvArena args; // command line of the last launch, reused while the topology holds
+
+    // server mode: the monitor polls /health, results are tagged with the launch they belong to
+    std::string host;
+    int port;
+    sockaddr_storage endpoint; // host:port as the resolver last had it, len 0 until then, guarded by mtx
+    socklen_t endpoint_len;
+    uint64_t generation; // unique per launch across all backends, guarded by mtx
+    bool up; // /health answered 200 for this launch, guarded by mtx
+    int health_failures; // consecutive failed checks after it was up, guarded by mtx
+
+    bool probing; // stalled, waiting on the monitor to say whether a server is behind it
+    std::chrono::steady_clock::time_point probe_since;
+
+    bool launching; // replaced, the new process waits on the monitor's rpc check
+    std::vector<pid_t> replaced; // children still connected to the pool's servers, the check waits until they're reaped
+    RestartReason launch_reason;
+    std::chrono::steady_clock::time_point launch_step; // end of the last traced step, the launch picks up from there
+    bool check_requested; // the monitor should verify this pool's servers, guarded by mtx
+    bool checked; // and it has, guarded by mtx
+
+    Backend(int pool, const SupervisorConfig& config)
+        : pool(pool), process(-1), out_fd(-1), err_fd(-1), load_bytes(0), load_sampled(false), stall(config), ngl(0), level(0), degraded(false),
+          kv_bytes(0), compute_bytes(0), log_ctx(0), log_ubatch(0), port(8080), endpoint(), endpoint_len(0), generation(0), up(false), health_failures(0),
+          probing(false), launching(false), launch_reason(RestartReason::START), check_requested(false), checked(false) {}
+};
+
+class DurableLLaMA {
+private:
+    std::vector<RPCServer> servers; // rpc servers in the cluster
+    std::vector<std::string> original_args; // cli arrguments from llama-cli
+    SupervisorConfig config; // wrapper options
+    std::mutex mtx; // guards servers between the main loop and the health monitor
+    std::condition_variable monitor_cv; // wakes the monitor early on shutdown
+    std::thread monitor_thread; // background prober
+    bool monitor_running; // guarded by mtx
+    std::atomic<bool> topology_changed; // set by the monitor when it drops a server
+    std::atomic<bool> readmit_pending; // set by the monitor when a dropped server has recovered
+    bool stall_probe_requested; // main loop wants a probe round of every server, guarded by mtx
+    bool stall_probe_lost; // and what it found: a server went away, guarded by mtx
+    std::atomic<bool> stall_probe_done; // set by the monitor once that round is in
+    bool launch_check_requested; // some backend has check_requested set, guarded by mtx
+
+    // one backend in cli mode, --dl-pools of them in server mode, each over a disjoint slice of servers
+    std::vector<Backend> backends; // sized once in the constructor, the monitor keeps references
+    uint64_t launches; // source of Backend::generation, guarded by mtx
+    std::atomic<bool> health_changed; // some backend came up or started failing
+    RunMetrics metrics;
+    ModelCache model_cache; // -m file kept in RAM, or staged to tmpfs, across relaunches
+    Resolver resolver; // node hostnames, looked up in the background
+    Terminator terminator; // children that were told to go and haven't been reaped yet
+    FailoverTrace trace; // --dl-trace spans, per backend
+
+    // --dl-metrics: the main loop copies its numbers here after every wakeup, the scraper renders from the copy
+    struct BackendView {
+        int pool;
+        pid_t pid;
+        int ngl;
+        int level;
+        std::string rpc;
+        const char* phase;
+    };
+    MetricsServer metrics_server;
+    std::mutex snapshot_mtx; // guards the two below, never held across anything slow
+    RunMetrics metrics_snapshot;
+    std::vector<BackendView> backend_snapshot; // written by the main thread only, which may read it without the lock
+    std::chrono::steady_clock::time_point metrics_due; // next time a wakeup is allowed to publish
+    bool metrics_pending; // a wakeup skipped publishing, the timer makes sure it goes out
+    static constexpr int METRICS_PUBLISH_MS = 1000; // how far behind a scrape can be while tokens stream
+    RequestProxy proxy; // --dl-listen front end, holds and replays requests across restarts
+    BatchRunner batch; // --dl-batch jobs, sent through the proxy
+    bool should_continue; // control flag for continue loop
+    bool fatal_launch; // llama-cli couldn't be spawned at all, the exit status says so
+    int original_ngl; // gpu layers from llama-cli
+
+    // event loop: one epoll set for the children's pipes, signals, the stall deadline and monitor wakeups.
+    // epoll data is the source in the low byte and the backend index above it
+    enum EventSource : uint32_t { EV_OUTPUT, EV_ERRLOG, EV_SIGNAL, EV_TIMER, EV_WAKE, EV_STANDBY, EV_PROXY };
+    int epoll_fd;
+    int signal_fd; // SIGINT, SIGTERM, SIGCHLD, SIGHUP
+    int timer_fd; // fires at the stall deadline
+    int wake_fd; // eventfd the monitor thread pokes when it drops a server
+    std::chrono::steady_clock::time_point armed_deadline; // what timer_fd is set to
+    bool timer_armed;
+
+    // token pass-through
+    std::vector<char> output_buffer; // reused for every read, never reallocated on the hot path
+    bool stdout_is_tty; // interactive: forward every read right away
+    bool splice_ok; // cleared if stdout turns out not to support splice()
+    static constexpr size_t OUTPUT_BUFFER_SIZE = 256 * 1024;
+    static constexpr int CHILD_PIPE_SIZE = 1024 * 1024; // room for load logs so llama-cli never blocks on us
+    static constexpr uint64_t MIN_LOAD_TRANSFER = 64 * 1024; // more than handshakes and keepalives, less than any tensor
+
+    // warm standby: a second llama-cli loaded ahead of time for the likeliest degraded topology, frozen with SIGSTOP.
+    // cli mode only, so it always stands in for backends[0]
+    pid_t standby_process;
+    int standby_fd; // read end of its stdout pipe, left unread until it's promoted
+    int standby_err_fd; // its stderr, read for the load marker
+    ChildLogParser standby_log;
+    ArgvArena standby_args;
+    std::string standby_rpc; // topology it was loaded for
+    int standby_ngl;
+    std::vector<LayerRange> standby_placement; // held by nobody until it's promoted
+    int standby_level;
+    bool standby_degraded;
+    bool standby_ready; // reached the load marker and is stopped
+    bool standby_gave_up; // died for this topology, don't respawn until the next restart
+    StallDetector standby_stall; // only used to spot the load marker
+
+    // resume: llama-cli saves the evaluated prompt to its --prompt-cache on the first sample,
+    // so a relaunch with prompt + generated text only evaluates what came after the last checkpoint
+    bool resume_enabled;
+    ResumeTracker resume;
+    std::string session_path;
+    bool own_session; // we picked the path, delete it when done
+    // layer rebalancing
+    uint64_t model_bytes; // size of the -m file, 0 if unknown
+    int model_layers; // n_layer from the load log, 0 until a load got that far
+    // what a load that died left for its topology: the first rung to try, or the -ngl cap once the ladder is used
+    // up. it expires after BACKOFF_TTL_S, or sooner once those servers report more free memory than they had
+    struct Backoff {
+        int limit = 0;
+        std::chrono::steady_clock::time_point since;
+        uint64_t free_mem = 0; // the topology's reported free memory when the load died, 0 if unknown
+    };
+    Backoff ngl_ceiling; // lowered each time a load dies on ceiling_rpc, guarded by mtx
+    std::string ceiling_rpc;
+    std::string all_rpc; // --rpc list with every server in it
+
+    // degradation ladder: rung 0 is the command line, each --dl-ladder step stacks on the one before, CPU comes
+    // last. every launch takes the first rung whose weights and KV cache fit the servers that are left, so
+    // stepping back up is just the next launch after capacity returns
+    struct Rung {
+        int ctx; // 0 for whatever llama.cpp picks
+        int batch;
+        std::string model;
+        uint64_t model_bytes;
+    };
+    std::vector<Rung> rungs;
+    std::map<std::string, Backoff> ladder_floor; // topology key -> first rung that hasn't died loading on it, guarded by mtx
+    std::atomic<bool> degraded; // some backend is degraded, recovered servers are worth a restart
+    // what a load put on the servers besides weights, so a smaller -c or -ub can be sized before trying it
+    double kv_bytes_per_cell; // per offloaded layer per context cell
+    double compute_bytes_per_token; // per server per ubatch token
+    int seen_ctx; // what llama.cpp settled on when the command line didn't say
+    int seen_ubatch;
+
+    std::string score_path; // where failure scores survive restarts of the supervisor, empty for nowhere
+    std::atomic<bool> scores_dirty; // a score went up, the main loop writes the file
+    bool user_split; // --tensor-split on the command line, servers keep their order for it
+    static constexpr long RTT_BUCKET_US = 100; // RTT differences below this don't reorder servers
+    static constexpr int RTT_MAX_AGE_ROUNDS = 4; // probe intervals an RTT sample is trusted for when ordering
+    static constexpr int RESOLVE_WAIT_MS = 5000; // startup wait for node hostnames, the rest resolve in the background
+    static constexpr long BACKOFF_TTL_S = 600; // a load that died this long ago says little about memory now
+    static constexpr double MEM_RECOVERED = 1.1; // free memory this much above the failed load's clears its back-off
+
+    // available servers of a pool in the order they go into --rpc, caller holds mtx. llama.cpp hands out
+    // layers in that order, so the closest servers go first and servers behind the same switch end up next
+    // to each other. costs are bucketed so jitter between equally close servers doesn't reshuffle them
+    std::vector<size_t> launch_order(int pool, int exclude = -1) {
+        std::vector<size_t> order;
+        int missing = 0; // regular nodes of the pool that are down, each one lets a standby node in
+        for (size_t i = 0; i < servers.size(); i++) {
+            const auto& server = servers[i];
+            if (server.pool != pool || server.retired || server.spec.standby) continue;
+            if (server.available && (int)i != exclude) order.push_back(i);
+            else missing++;
+        }
+        for (size_t i = 0; i < servers.size() && missing > 0; i++) {
+            const auto& server = servers[i];
+            if (server.pool != pool || !server.spec.standby || !server.available || (int)i == exclude) continue;
+            order.push_back(i);
+            missing--;
+        }
+        bench_flaky(order, exclude < 0);
+        if (!config.rpc_order || user_split) return order; // their --tensor-split is positional
+        auto now = std::chrono::steady_clock::now();
+        auto max_age = std::chrono::milliseconds(RTT_MAX_AGE_ROUNDS * config.probe_interval_ms);
+        auto bucket = [&](size_t i) {
+            long cost = servers[i].network_cost_us(now, max_age);
+            return cost < 0 ? LONG_MAX : cost / RTT_BUCKET_US; // unmeasured and stale ones keep their place at the back
+        };
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return bucket(a) < bucket(b); });
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return servers[a].spec.priority < servers[b].spec.priority;
+        });
+        if (sticky()) { // servers holding layers keep their places, a cache only helps if they get the same layers back
+            auto held = [this](size_t i) { return servers[i].held_count > 0 ? servers[i].held_first : INT_MAX; };
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return held(a) < held(b); });
+        }
+        return order;
+    }
+
+    bool sticky() const { return config.sticky_slack > 0 && config.rebalance && !user_split; }
+
+    static int overlap(int first, int count, int other_first, int other_count) { // layers two ranges share
+        return std::max(0, std::min(first + count, other_first + other_count) - std::max(first, other_first));
+    }
+
+    // whole layers per server for layers [first, first + layers), each within the slack of its water-fill share.
+    // inside that, the fewest layers land on a server that doesn't already hold them, then the closest to the
+    // shares. a boundary DP since llama.cpp hands out contiguous blocks in --rpc order. caller holds mtx
+    std::vector<int> sticky_counts(const std::vector<size_t>& members, const std::vector<double>& share,
+                                   const std::vector<double>& caps, int layers, int first) {
+        const double INF = std::numeric_limits<double>::infinity();
+        size_t n = members.size();
+        std::vector<std::vector<double>> cost(n + 1, std::vector<double>(layers + 1, INF)); // first k servers cover b layers
+        std::vector<std::vector<int>> pick(n + 1, std::vector<int>(layers + 1, 0));
+        cost[0][0] = 0;
+        double deviation_scale = 2.0 * layers + 1; // total deviation stays under one moved layer
+        for (size_t k = 0; k < n; k++) {
+            const auto& server = servers[members[k]];
+            double slack = std::max(1.0, share[k] * config.sticky_slack);
+            int lo = std::max(0, (int)std::ceil(share[k] - slack));
+            int hi = (int)std::min(caps[k], std::floor(share[k] + slack));
+            for (int b = 0; b <= layers; b++) {
+                if (cost[k][b] == INF) continue;
+                for (int c = lo; c <= hi && b + c <= layers; c++) {
+                    int moved = c - overlap(first + b, c, server.held_first, server.held_count);
+                    double total = cost[k][b] + moved + std::fabs(c - share[k]) / deviation_scale;
+                    if (total < cost[k + 1][b + c]) {
+                        cost[k + 1][b + c] = total;
+                        pick[k + 1][b + c] = c;
+                    }
+                }
+            }
+        }
+        if (cost[n][layers] == INF) return {};
+        std::vector<int> counts(n);
+        for (size_t k = n, b = layers; k > 0; k--) {
+            counts[k - 1] = pick[k][b];
+            b -= pick[k][b];
+        }
+        return counts;
+    }
+
+    // what the running process holds when it went out before n_layer was known, worked out the way llama.cpp
+    // does it: layer i goes to the first server whose running share of the split passes i / layers
+    LaunchPlan launched_placement(const Backend& backend) {
+        LaunchPlan plan;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!sticky() || backend.rpc.empty() || model_layers <= 0) return plan;
+        std::vector<size_t> members;
+        std::stringstream list(backend.rpc);
+        std::string address;
+        while (std::getline(list, address, ',')) {
+            auto it = std::find_if(servers.begin(), servers.end(), [&](const RPCServer& s) { return s.rpc_address() == address; });
+            if (it == servers.end()) return plan;
+            members.push_back(it - servers.begin());
+        }
+        std::vector<double> cumulative;
+        std::stringstream split(backend.tensor_split);
+        std::string part;
+        for (size_t k = 0; k < members.size(); k++) { // no split of ours means llama.cpp went by free memory
+            double weight = (double)servers[members[k]].free_mem;
+            if (!backend.tensor_split.empty()) weight = std::getline(split, part, ',') ? std::stod(part) : 0;
+            cumulative.push_back((cumulative.empty() ? 0 : cumulative.back()) + weight);
+        }
+        if (cumulative.back() <= 0) return plan;
+        int layers = std::min(backend.ngl, model_layers + 1);
+        int first = model_layers + 1 - layers;
+        std::vector<int> counts(members.size(), 0);
+        for (int i = 0; i < layers; i++) {
+            auto it = std::upper_bound(cumulative.begin(), cumulative.end(), cumulative.back() * i / layers);
+            counts[std::min<size_t>(it - cumulative.begin(), members.size() - 1)]++;
+        }
+        for (size_t k = 0; k < members.size(); k++) {
+            plan.placement.push_back({members[k], first, counts[k]});
+            first += counts[k];
+        }
+        return plan;
+    }
+
+    void commit_placement(const LaunchPlan& plan, int pool) { // the launch went out, remember who holds what
+        if (plan.placement.empty()) return;
+        int kept = 0, moved = 0;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const auto& range : plan.placement) {
+                auto& server = servers[range.server];
+                int same = overlap(range.first, range.count, server.held_first, server.held_count);
+                kept += same;
+                moved += range.count - same;
+                server.held_first = range.first;
+                server.held_count = range.count;
+            }
+        }
+        event_log.emit("layer_placement").field("pool", pool).field("kept", kept).field("moved", moved);
+    }
+
+    void refresh_endpoints() { // the resolver's latest answers into servers, caller holds mtx
+        for (auto& server : servers) {
+            Resolver::Entry entry;
+            if (server.retired || !resolver.lookup(server.ip, entry)) continue;
+            server.endpoint = entry.addr;
+            server.endpoint_len = entry.len;
+            Resolver::set_port(server.endpoint, server.port);
+            std::string port = std::to_string(server.port);
+            if (entry.addr.ss_family == AF_INET6) server.numeric_address = "[" + entry.numeric + "]:" + port;
+            else server.numeric_address = entry.numeric + ":" + port;
+        }
+        for (auto& backend : backends) { // llama-server's --host, for /health and the proxy
+            Resolver::Entry entry;
+            if (!resolver.lookup(backend.host, entry)) continue;
+            backend.endpoint = entry.addr;
+            backend.endpoint_len = entry.len;
+            Resolver::set_port(backend.endpoint, backend.port);
+        }
+    }
+
+    std::string build_rpc_string(int pool = 0, int exclude = -1) { // string of available RPC servers, caller holds mtx
+        std::string rpc_servers;
+        bool first = true;
+        for (size_t i : launch_order(pool, exclude)) { // for all servers
+            if (!first) rpc_servers += ","; // separate them
+            rpc_servers += servers[i].rpc_address(); // pre-resolved, llama-cli never waits on DNS either
+            first = false;
+        }
+        return rpc_servers;
+    }
+    // builts to format "ip1:port1,ip2:port2, etc"
+
+    // main thread, whenever a process starts or stops holding servers: the monitor stops probing the ones held
+    void mark_in_use() {
+        std::vector<std::string> held;
+        for (const auto& backend : backends) {
+            if (backend.process > 0) held.push_back("," + backend.rpc + ",");
+        }
+        if (standby_process > 0) held.push_back("," + standby_rpc + ",");
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& server : servers) {
+            std::string member = "," + server.rpc_address() + ",";
+            server.in_use = std::any_of(held.begin(), held.end(), [&](const std::string& rpc) {
+                return rpc.find(member) != std::string::npos;
+            });
+        }
+    }
+
+    static std::string topology_key(const std::string& rpc) { // same servers in any order compare equal
+        std::vector<std::string> members;
+        std::stringstream list(rpc);
+        std::string member;
+        while (std::getline(list, member, ',')) members.push_back(member);
+        std::sort(members.begin(), members.end());
+        std::string key;
+        for (const auto& m : members) key += m + ",";
+        return key;
+    }
+
+    // works out -ngl and --tensor-split for the servers that are left, caller holds mtx.
+    // layers go out in proportion to free memory, trimmed for servers that answer RPC slowly, and capped
+    // by what each one can hold; whatever doesn't fit stays on the local CPU rather than dropping to -ngl 0
+    LaunchPlan plan_launch(int pool = 0, int exclude = -1) {
+        std::string rpc = build_rpc_string(pool, exclude);
+        std::string key = topology_key(rpc);
+        auto floor = ladder_floor.find(key);
+        if (floor != ladder_floor.end() && backoff_expired(floor->second, rpc, "ladder")) {
+            ladder_floor.erase(floor);
+            floor = ladder_floor.end();
+        }
+        if (!ceiling_rpc.empty() && topology_key(ceiling_rpc) == key && backoff_expired(ngl_ceiling, rpc, "ngl")) ceiling_rpc.clear();
+        int level = floor == ladder_floor.end() ? 0 : floor->second.limit;
+        LaunchPlan plan = plan_rung(pool, exclude, level);
+        while (plan.capped_from > 0 && level + 1 < (int)rungs.size()) plan = plan_rung(pool, exclude, ++level); // a rung down
+        if (plan.capped_from > 0) {
+            event_log.emit("layers_capped").field("pool", pool).field("capacity", plan.ngl).field("layers", plan.capped_from);
+        }
+        return plan;
+    }
+
+    // free memory the servers in an --rpc list reported, 0 unless every one of them did. caller holds mtx
+    uint64_t topology_free(const std::string& rpc) {
+        uint64_t total = 0;
+        std::stringstream list(rpc);
+        std::string member;
+        while (std::getline(list, member, ',')) {
+            auto it = std::find_if(servers.begin(), servers.end(), [&](const RPCServer& s) { return s.rpc_address() == member; });
+            if (it == servers.end() || it->free_mem == 0) return 0;
+            total += it->free_mem;
+        }
+        return total;
+    }
+
+    // a back-off stops applying once it's old, or once the servers have memory back that the failed load didn't
+    // have, say after another tenant exited. caller holds mtx
+    bool backoff_expired(const Backoff& backoff, const std::string& rpc, const char* kind) {
+        auto now = std::chrono::steady_clock::now();
+        uint64_t free_mem = topology_free(rpc);
+        const char* reason = nullptr;
+        if (now - backoff.since >= std::chrono::seconds(BACKOFF_TTL_S)) reason = "timeout";
+        else if (backoff.free_mem > 0 && free_mem > backoff.free_mem * MEM_RECOVERED) reason = "memory";
+        if (!reason) return false;
+        event_log.emit("backoff_expired").field("kind", kind).field("limit", backoff.limit).field("reason", reason)
+            .field("free_mib", free_mem >> 20).field("was_free_mib", backoff.free_mem >> 20);
+        return true;
+    }
+
+    // layers a server can hold on a rung, 1e9 while the layer size is unknown. caller holds mtx
+    double layer_capacity(const RPCServer& server, const Rung& rung) {
+        double bytes_per_layer = model_layers > 0 && rung.model_bytes > 0 ? (double)rung.model_bytes / (model_layers + 1) : 0;
+        if (bytes_per_layer > 0) bytes_per_layer += kv_bytes_per_cell * (rung.ctx > 0 ? rung.ctx : seen_ctx);
+        double reserved = compute_bytes_per_token * (rung.batch > 0 ? rung.batch : seen_ubatch);
+        double usable = std::max(0.0, server.planning_mem() * config.mem_headroom - reserved);
+        double cap = bytes_per_layer > 0 ? std::floor(usable / bytes_per_layer) : 1e9;
+        if (server.spec.max_layers > 0) cap = std::min(cap, (double)server.spec.max_layers);
+        return cap;
+    }
+
+    // a server whose score says it'll cost another restart soon sits out as long as the rest can hold every
+    // layer at rung 0: nothing moves to the CPU without it, so all it would add is the restarts. worst first.
+    // caller holds mtx
+    void bench_flaky(std::vector<size_t>& order, bool log) {
+        if (config.flaky_score <= 0 || user_split || model_layers <= 0 || rungs[0].model_bytes == 0) return;
+        auto now = std::chrono::steady_clock::now();
+        double capacity = 0;
+        std::vector<size_t> flaky;
+        for (size_t i : order) {
+            if (servers[i].planning_mem() == 0) return; // can't tell what the others hold
+            capacity += layer_capacity(servers[i], rungs[0]);
+            if (servers[i].score(now, config.score_half_life_s) >= config.flaky_score) flaky.push_back(i);
+        }
+        std::sort(flaky.begin(), flaky.end(), [&](size_t a, size_t b) {
+            return servers[a].score(now, config.score_half_life_s) > servers[b].score(now, config.score_half_life_s);
+        });
+        int needed = std::min(original_ngl, model_layers + 1);
+        std::vector<bool> out(servers.size(), false);
+        for (size_t i : flaky) {
+            double cap = layer_capacity(servers[i], rungs[0]);
+            if (capacity - cap < needed) continue;
+            capacity -= cap;
+            out[i] = true;
+        }
+        order.erase(std::remove_if(order.begin(), order.end(), [&](size_t i) { return out[i]; }), order.end());
+        if (!log) return;
+        for (size_t i = 0; i < servers.size(); i++) {
+            auto& server = servers[i];
+            if (server.benched == out[i] || (!out[i] && !server.available)) continue;
+            server.benched = out[i];
+            event_log.emit(out[i] ? "server_benched" : "server_unbenched").field("server", server.address)
+                .field("score", server.score(now, config.score_half_life_s));
+        }
+    }
+
+    // one rung's plan. a rung's weights are its model's size, and once a load has reported its buffers, the
+    // KV cache for its -c and the compute buffer for its -ub count against each server's memory too
+    LaunchPlan plan_rung(int pool, int exclude, int level) {
+        LaunchPlan plan;
+        plan.rpc = build_rpc_string(pool, exclude);
+        if (plan.rpc.empty()) return plan; // CPU fallback, -ngl 0
+        plan.level = level;
+        plan.ngl = original_ngl;
+        bool last_rung = level + 1 == (int)rungs.size(); // fewer layers only once the ladder has nothing left
+        if (last_rung && topology_key(plan.rpc) == topology_key(ceiling_rpc)) plan.ngl = std::min(plan.ngl, ngl_ceiling.limit);
+        if (!config.rebalance) return plan;
+
+        std::vector<size_t> members;
+        std::vector<long> latencies;
+        for (size_t i : launch_order(pool, exclude)) { // same order as plan.rpc, the split is positional
+            if (servers[i].planning_mem() == 0) return plan; // no memory known for someone, leave llama.cpp's split alone
+            members.push_back(i);
+            if (servers[i].rpc_latency_us > 0) latencies.push_back(servers[i].rpc_latency_us);
+        }
+        long median_latency = 0;
+        if (!latencies.empty()) {
+            std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+            median_latency = latencies[latencies.size() / 2];
+        }
+
+        std::vector<double> weights;
+        std::vector<double> caps; // layers each server can hold, unbounded if the layer size is unknown
+        auto now = std::chrono::steady_clock::now();
+        for (size_t m : members) {
+            const auto& server = servers[m];
+            double factor = 1.0;
+            if (median_latency > 0 && server.rpc_latency_us > 0) {
+                factor = std::min(1.0, std::max(0.5, (double)median_latency / server.rpc_latency_us));
+            }
+            double reliability = 1 / (1 + server.score(now, config.score_half_life_s)); // a flaky node holds less
+            weights.push_back(server.planning_mem() * factor * server.spec.speed * reliability);
+            caps.push_back(layer_capacity(server, rungs[level]));
+        }
+
+        int layers = model_layers > 0 ? std::min(plan.ngl, model_layers + 1) : plan.ngl; // +1 for the output layer
+        double capacity = 0;
+        for (double cap : caps) capacity += cap;
+        if (capacity < layers) {
+            plan.capped_from = layers;
+            layers = (int)capacity;
+            plan.ngl = layers;
+        }
+        if (layers <= 0) {
+            plan.ngl = 0;
+            return plan;
+        }
+
+        // water-fill: hand out layers by weight, re-spreading whatever a full server can't take
+        std::vector<double> share(members.size(), 0);
+        std::vector<bool> full(members.size(), false);
+        double left = layers;
+        for (size_t round = 0; round < members.size() && left > 0.5; round++) {
+            double open_weight = 0;
+            for (size_t k = 0; k < members.size(); k++) if (!full[k]) open_weight += weights[k];
+            if (open_weight <= 0) break;
+            double handed = 0;
+            for (size_t k = 0; k < members.size(); k++) {
+                if (full[k]) continue;
+                double want = left * weights[k] / open_weight;
+                double give = std::min(want, caps[k] - share[k]);
+                share[k] += give;
+                handed += give;
+                if (share[k] >= caps[k]) full[k] = true;
+            }
+            left -= handed;
+        }
+
+        std::vector<int> counts;
+        if (model_layers > 0) {
+            int first = model_layers + 1 - layers; // llama.cpp offloads the last -ngl layers
+            if (sticky()) counts = sticky_counts(members, share, caps, layers, first);
+            for (size_t k = 0; k < counts.size(); k++) {
+                plan.placement.push_back({members[k], first, counts[k]});
+                first += counts[k];
+            }
+        }
+
+        if (members.size() < 2) return plan; // nothing to split
+
+        std::ostringstream split;
+        for (size_t k = 0; k < members.size(); k++) {
+            if (k) split << ",";
+            if (counts.empty()) split << std::lround(share[k] * 100); // proportions, scaled by 100 to keep it integral
+            else split << counts[k]; // whole layers, so the block boundaries land exactly where we planned them
+        }
+        plan.tensor_split = split.str();
+        return plan;
+    }
+
+    // inference status check
+    void check_inference_status() {
+        if (config.server_mode() && health_changed.exchange(false)) {
+            for (size_t i = 0; i < backends.size(); i++) {
+                auto& backend = backends[i];
+                bool up;
+                int failures;
+                BackendAddress address = {backend.host, backend.port, 0};
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    up = backend.up;
+                    failures = backend.health_failures;
+                    address.generation = backend.generation;
+                    address.addr = backend.endpoint;
+                    address.len = backend.endpoint_len;
+                }
+                if (failures >= config.fail_threshold) {
+                    event_log.emit("health_failed").field("pool", backend.pool).field("failures", failures);
+                    restart_llama(backend, RestartReason::HEALTH);
+                    continue;
+                }
+                if (up && backend.stall.phase() != RunPhase::SERVING) {
+                    event_log.emit("backend_up").field("pool", backend.pool).field("host", backend.host).field("port", backend.port);
+                    backend.stall.reset(std::chrono::steady_clock::now(), RunPhase::SERVING); // silence is fine from here on
+                    metrics.on_serving(i, std::chrono::steady_clock::now());
+                    trace.in_service(i, std::chrono::steady_clock::now());
+                    if (proxy.enabled()) proxy.backend_ready(i, address);
+                }
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now(); // get current time
+        for (auto& backend : backends) {
+            if (backend.process <= 0 || backend.probing || !backend.stall.stalled(now)) continue; // restarts inference on remaining PIs if no server is available
+            if (backend.stall.phase() == RunPhase::LOAD && load_transfer_moved(backend, now)) continue; // slow, not stuck
+            event_log.emit("stalled").field("pool", backend.pool).field("silent_ms", backend.stall.silent_ms(now))
+                .field("phase", backend.stall.phase_name()).field("limit_ms", backend.stall.limit_ms());
+            size_t index = &backend - backends.data();
+            auto silent_since = now - std::chrono::milliseconds(backend.stall.silent_ms(now));
+            trace.begin(index, "stalled", silent_since); // the silence is part of the outage
+            trace.span(index, "silence", silent_since, now, "\"phase\":\"" + std::string(backend.stall.phase_name()) + "\"");
+            backend.probing = true; // restarted once the monitor says whether a server is behind it
+            backend.probe_since = now;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stall_probe_requested = true;
+            }
+            monitor_cv.notify_all();
+        }
+
+        if (stall_probe_done.exchange(false)) { // servers it found dead in other pools get picked up below
+            bool lost;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                lost = stall_probe_lost;
+            }
+            for (auto& backend : backends) {
+                if (!backend.probing) continue;
+                trace.span(&backend - backends.data(), "probe_servers", backend.probe_since, std::chrono::steady_clock::now());
+                restart_llama(backend, lost ? RestartReason::UNREACHABLE : RestartReason::STALLED);
+            }
+        }
+
+        if (topology_changed.exchange(false)) { // the monitor already dropped a server, no need to wait for silence
+            for (auto& backend : backends) {
+                std::string wanted;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    wanted = build_rpc_string(backend.pool);
+                }
+                if (topology_key(wanted) == topology_key(backend.rpc)) continue; // the loss was in another pool
+                event_log.emit("topology_changed").field("pool", backend.pool).field("rpc", wanted);
+                restart_llama(backend, RestartReason::UNREACHABLE);
+            }
+        }
+
+        if (readmit_pending) {
+            bool waiting = false; // a pool with a recovered server that is busy right now
+            readmit_pending = false;
+            for (auto& backend : backends) {
+                if (backend.launching || !pool_has_recovered(backend.pool)) continue; // about to launch on the latest state anyway
+                if (!at_safe_point(backend)) {
+                    waiting = true;
+                    continue;
+                }
+                event_log.emit("readmit_restart").field("pool", backend.pool);
+                restart_llama(backend, RestartReason::READMIT);
+            }
+            if (waiting) readmit_pending = true;
+            if (proxy.enabled()) proxy.notify_idle(waiting ? wake_fd : -1); // try again once its requests settle
+        }
+
+        auto step = std::chrono::steady_clock::now();
+        bool had_standby = standby_process > 0;
+        maybe_start_standby();
+        if (!had_standby && standby_process > 0) step = trace_step("start_standby", step); // spawns on the loop's time
+        if (scores_dirty.exchange(false)) {
+            save_scores();
+            trace_step("save_scores", step);
+        }
+    }
+
+    // a span for every open incident, they all sat through it. returns the end, for the next step
+    std::chrono::steady_clock::time_point trace_step(const char* name, std::chrono::steady_clock::time_point start) {
+        auto end = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < backends.size(); i++) trace.span(i, name, start, end);
+        return end;
+    }
+
+    std::chrono::steady_clock::time_point trace_step(size_t index, const char* name, std::chrono::steady_clock::time_point start) {
+        auto end = std::chrono::steady_clock::now();
+        trace.span(index, name, start, end);
+        return end;
+    }
+
+    // the LOAD phase's starting point for load_transfer_moved(). a fresh child usually has no sockets yet,
+    // so monitor_stderr() tries again on its first load log output
+    void sample_load_baseline(Backend& backend) {
+        backend.load_sampled = SocketCounters::sample(backend.process, backend.load_bytes);
+        if (!backend.load_sampled) backend.load_bytes = 0;
+    }
+
+    // a load that has gone quiet for its whole limit is only stuck if its sockets stopped moving bytes too.
+    // checked at the deadline, so one sample per load_timeout window and nothing on the hot path
+    bool load_transfer_moved(Backend& backend, std::chrono::steady_clock::time_point now) {
+        uint64_t bytes;
+        if (!SocketCounters::sample(backend.process, bytes) || bytes < backend.load_bytes + MIN_LOAD_TRANSFER) return false;
+        double window_s = backend.stall.silent_ms(now) / 1000.0;
+        event_log.emit("load_transfer").field("pool", backend.pool).field("bytes", bytes)
+            .field("mib_per_s", window_s > 0 ? (bytes - backend.load_bytes) / window_s / (1 << 20) : 0.0);
+        backend.load_bytes = bytes;
+        backend.load_sampled = true;
+        backend.stall.on_progress(now); // next check one limit from now
+        return true;
+    }
+
+    // monitor thread, asked for by a stall: probes every server, the ones in use too, and marks the dead ones
+    // unavailable. the answer goes back through wake_fd so the event loop never waits on the network
+    void drop_unreachable_servers(std::unique_lock<std::mutex>& lock) {
+        refresh_endpoints();
+        std::vector<RPCServer> snapshot = servers;
+        lock.unlock();
+        auto probes = ProbeEngine::probe_all(snapshot, config.probe_timeout_ms); // probe all servers in parallel
+        auto probe_time = std::chrono::steady_clock::now();
+        lock.lock();
+
+        bool any_server_removed = false; // initialized server removal flag to false
+        for (size_t i = 0; i < servers.size() && i < probes.size(); i++) { // a reload may have added some meanwhile
+            auto& server = servers[i];
+            server.record_probe(probes[i], probe_time);
+            if (server.available && !probes[i].reachable) { // if server is marked available but can't be reached
+                server.available = false;
+                any_server_removed = true;
+                server.record_failure(probe_time, config.score_half_life_s);
+                scores_dirty = true;
+                event_log.emit("server_removed").field("server", server.address).field("reason", "unreachable");
+                // mark unavailable, set removal flag, log removal
+            }
+        }
+        if (any_server_removed) topology_changed = true; // pools other than the one restarting may have lost a server too
+
+        if (!any_server_removed) {
+            event_log.emit("servers_reachable"); // for stalled inference
+        } else if (std::none_of(servers.begin(), servers.end(), [](const RPCServer& s){ return s.available; })) { // if all servers are unavailable
+            event_log.emit("cpu_fallback"); // fallback to cpu
+        }
+        stall_probe_lost = any_server_removed;
+        stall_probe_done = true;
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) log_error("eventfd write");
+    }
+
+    bool readmit_recovered(int pool) { // put recovered servers back in the pool, returns true if any came back
+        if (config.readmit == "off") return false;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto now = std::chrono::steady_clock::now();
+        bool any = false;
+        for (auto& server : servers) {
+            if (server.pool != pool || !server.recovered(config, now)) continue;
+            server.available = true;
+            server.readmissions++;
+            any = true;
+            event_log.emit("server_readmitted").field("server", server.address).field("healthy_probes", server.consecutive_successes);
+        }
+        return any;
+    }
+
+    bool pool_has_recovered(int pool) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto now = std::chrono::steady_clock::now();
+        return std::any_of(servers.begin(), servers.end(), [&](const RPCServer& server) {
+            return server.pool == pool && server.recovered(config, now);
+        });
+    }
+
+    bool readmit_possible() { // whether some backend may take recovered servers back before its next restart
+        if (config.readmit == "immediate") return true;
+        return config.readmit != "off" && (degraded || proxy.enabled()); // the proxy knows when a server is between requests
+    }
+
+    // whether a topology change may interrupt this backend now: a degraded run is worth trading in, and a server
+    // with no request in flight loses nothing but its loaded model. main thread
+    bool at_safe_point(Backend& backend) {
+        if (config.readmit == "immediate") return true;
+        if (config.readmit == "off") return false;
+        if (backend.degraded) return true;
+        return backend.process > 0 && proxy.enabled() && proxy.claim_idle(&backend - backends.data());
+    }
+
+    void update_degraded() {
+        degraded = std::any_of(backends.begin(), backends.end(), [](const Backend& b) { return b.process > 0 && b.degraded; });
+    }
+
+    // app-level check right before a launch. rpc-server serves one client at a time, so this only means
+    // something once the old llama-cli is gone; the background monitor sticks to TCP for that reason,
+    // and only the pool being launched is checked since the others are busy serving their own backend.
+    // runs on the monitor thread with mtx held, dropped across the probes
+    void verify_rpc_servers(std::unique_lock<std::mutex>& lock, int pool) {
+        std::vector<RPCServer> snapshot;
+        std::vector<size_t> members; // snapshot slot -> index in servers
+        refresh_endpoints();
+        for (size_t i = 0; i < servers.size(); i++) {
+            if (servers[i].pool != pool || !servers[i].available) continue;
+            members.push_back(i);
+            snapshot.push_back(servers[i]);
+        }
+        lock.unlock();
+        auto probes = ProbeEngine::probe_all(snapshot, config.rpc_budget_ms, ProbeMode::RPC);
+        lock.lock();
+
+        for (size_t k = 0; k < members.size(); k++) {
+            auto& server = servers[members[k]];
+            if (!server.available) continue;
+            const auto& probe = probes[k];
+            if (!probe.rpc_healthy()) {
+                server.available = false;
+                server.record_failure(std::chrono::steady_clock::now(), config.score_half_life_s);
+                scores_dirty = true;
+                event_log.emit("rpc_check_failed").field("server", server.address)
+                    .field("reason", probe.rpc_timed_out ? "timeout" : probe.reachable ? "unexpected_reply" : "unreachable")
+                    .field("budget_ms", config.rpc_budget_ms);
+                continue;
+            }
+            if (probe.rpc_ok) {
+                server.free_mem = probe.free_mem;
+                server.total_mem = probe.total_mem;
+                server.rpc_latency_us = probe.rpc_latency_us;
+                server.rpc_checked = std::chrono::steady_clock::now();
+                event_log.emit("rpc_check").field("server", server.address)
+                    .field("protocol", std::to_string(probe.proto_major) + "." + std::to_string(probe.proto_minor) + "." +
+                                       std::to_string(probe.proto_patch))
+                    .field("free_mib", probe.free_mem >> 20).field("total_mib", probe.total_mem >> 20)
+                    .field("latency_ms", probe.rpc_latency_us / 1000.0);
+            }
+        }
+    }
+
+    void check_backend_health(std::unique_lock<std::mutex>& lock) { // one /health round trip per backend, called with mtx held
+        for (auto& backend : backends) {
+            uint64_t generation = backend.generation;
+            sockaddr_storage addr = backend.endpoint;
+            socklen_t len = backend.endpoint_len;
+            lock.unlock();
+            int status = ProbeEngine::http_status(addr, len, backend.host, "/health", config.probe_timeout_ms);
+            lock.lock();
+            if (generation != backend.generation) continue; // relaunched meanwhile, this result is stale
+
+            bool notify = false;
+            if (status == 200) {
+                if (!backend.up) notify = true;
+                backend.up = true;
+                backend.health_failures = 0;
+            } else if (backend.up) { // 503 while loading is expected, anything after that counts
+                backend.health_failures++;
+                if (backend.health_failures >= config.fail_threshold) notify = true;
+            }
+            if (notify) {
+                health_changed = true;
+                uint64_t one = 1;
+                if (write(wake_fd, &one, sizeof(one)) < 0) log_error("eventfd write");
+            }
+        }
+    }
+
+    void health_monitor_loop() { // probes every server on a fixed interval and drops the ones that go down
+        std::unique_lock<std::mutex> lock(mtx);
+        while (monitor_running) {
+            auto round_start = std::chrono::steady_clock::now();
+            if (stall_probe_requested) { // a stalled backend is waiting on this, it goes before the regular round
+                stall_probe_requested = false;
+                drop_unreachable_servers(lock);
+                continue;
+            }
+            if (launch_check_requested) { // a launch is held until its pool has been checked
+                launch_check_requested = false;
+                for (auto& backend : backends) {
+                    if (!backend.check_requested) continue;
+                    backend.check_requested = false;
+                    verify_rpc_servers(lock, backend.pool);
+                    backend.checked = true;
+                }
+                uint64_t one = 1;
+                if (write(wake_fd, &one, sizeof(one)) < 0) log_error("eventfd write");
+                continue;
+            }
+            refresh_endpoints(); // picks up whatever the resolver learned since the last round
+            std::vector<RPCServer> snapshot; // probe copies so the lock isn't held across the network
+            std::vector<size_t> probed; // their indices in servers
+            for (size_t i = 0; i < servers.size(); i++) {
+                if (servers[i].in_use) continue; // idle, dropped and benched servers only
+                snapshot.push_back(servers[i]);
+                probed.push_back(i);
+            }
+            lock.unlock();
+            auto probes = ProbeEngine::probe_all(snapshot, config.probe_timeout_ms);
+            lock.lock();
+
+            auto now = std::chrono::steady_clock::now();
+            for (size_t k = 0; k < probed.size() && k < probes.size(); k++) {
+                if (probed[k] >= servers.size()) continue; // shouldn't happen, servers only grows
+                auto& server = servers[probed[k]];
+                if (server.in_use) continue; // launched on while we were probing, a failure here means nothing
+                server.record_probe(probes[k], now);
+                if (server.available && server.consecutive_failures >= config.fail_threshold) {
+                    server.available = false;
+                    server.record_failure(now, config.score_half_life_s);
+                    scores_dirty = true;
+                    topology_changed = true; // main loop restarts on the next pass
+                    uint64_t one = 1;
+                    if (write(wake_fd, &one, sizeof(one)) < 0) log_error("eventfd write");
+                    event_log.emit("server_removed").field("server", server.address).field("reason", "probe")
+                        .field("failures", server.consecutive_failures);
+                } else if (readmit_possible() && !readmit_pending && server.recovered(config, now)) {
+                    readmit_pending = true; // main loop decides whether now is a good moment
+                    uint64_t one = 1;
+                    if (write(wake_fd, &one, sizeof(one)) < 0) log_error("eventfd write");
+                }
+            }
+
+            if (config.server_mode()) check_backend_health(lock);
+
+            monitor_cv.wait_until(lock, round_start + std::chrono::milliseconds(config.probe_interval_ms),
+                                  [this] { return !monitor_running || stall_probe_requested || launch_check_requested; });
+        }
+    }
+
+    static bool is_prompt_arg(const std::string& arg) {
+        return arg == "-p" || arg == "--prompt" || arg == "-f" || arg == "--file";
+    }
+
+    static bool is_predict_arg(const std::string& arg) {
+        return arg == "-n" || arg == "--predict" || arg == "--n-predict";
+    }
+
+    // primary launches carry the resume state, a standby gets the plain command line minus --prompt-cache.
+    // the arena only gets rebuilt for a new topology, or when there's generated text to hand over
+    void build_command_args(const LaunchPlan& plan, const Backend& backend, ArgvArena& args, bool primary = true) { //extracts and rebuilds command line args from llama.cpp
+        bool skip_next = false; // skip args
+        bool with_session = primary && resume_enabled;
+        bool resuming = with_session && resume.usable() && !resume.generated().empty();
+
+        std::string key = plan.rpc + "|" + std::to_string(plan.ngl) + "|" + plan.tensor_split + "|" + std::to_string(plan.level);
+        if (!resuming && !args.empty() && args.key == key) return; // same command line as the last launch
+        args.clear();
+        if (!resuming) args.key = key; // a resume prompt is only good once
+        args.add(config.llama_binary()); // add exec name for first arg
+
+        // Check if we have any available RPC servers, if not, fallback to CPU only
+        bool is_fallback = plan.rpc.empty();
+        bool keep_user_split = plan.tensor_split.empty() && plan.rpc == all_rpc; // theirs only lines up with the full list
+        const Rung& rung = rungs[plan.level];
+        bool new_ctx = rung.ctx != rungs[0].ctx, new_batch = rung.batch != rungs[0].batch, new_model = rung.model != rungs[0].model;
+
+        for (size_t i = 0; i < original_args.size(); i++) { // process all llama-cli arguments except RPC and NGL
+            if (skip_next) {
+                skip_next = false;
+                continue;
+            }
+
+            // Skip existing RPC and ngl arguments
+            if (original_args[i] == "--rpc" ||
+                original_args[i] == "-ngl" ||
+                original_args[i] == "--n-gpu-layers") {
+                skip_next = true;
+                continue;
+            }
+
+            if ((original_args[i] == "-ts" || original_args[i] == "--tensor-split") && !keep_user_split) {
+                skip_next = true;
+                continue;
+            }
 
-struct RPCServer { // rpc server endpoint
-    std::string address;
-    std::string ip;
-    int port;
-    bool available;
+            if (config.server_mode() && original_args[i] == "--port") { // each pool gets its own
+                skip_next = true;
+                continue;
+            }
 
-    RPCServer(const std::string& addr) : // constructor to initialize and parse addr
-        address(addr),
-        available(true) {
-        parse_address();
-    }
+            const std::string& arg = original_args[i];
+            if ((new_ctx && (arg == "-c" || arg == "--ctx-size")) || (new_model && (arg == "-m" || arg == "--model")) ||
+                (new_batch && (arg == "-b" || arg == "--batch-size" || arg == "-ub" || arg == "--ubatch-size"))) {
+                skip_next = true; // this rung's value goes in below
+                continue;
+            }
 
-    void parse_address() { // parse addr into IP and port
-        size_t colon_pos = address.find(':');
-        if (colon_pos != std::string::npos) {
-            ip = address.substr(0, colon_pos);
-            port = std::stoi(address.substr(colon_pos + 1));
-        } else {
-            ip = address;
-            port = 50053; // RPC port for the PIs
+            if ((with_session && original_args[i] == "--prompt-cache") ||
+                (resuming && (is_prompt_arg(original_args[i]) || is_predict_arg(original_args[i])))) {
+                skip_next = true; // replaced below
+                continue;
+            }
+            if (!primary && original_args[i] == "--prompt-cache") { // the primary's file, two writers would clobber it
+                skip_next = true;
+                continue;
+            }
+
+            args.add(original_args[i]); // add args to the arena
         }
-    }
-};
 
-class DurableLLaMA {
-private:
-    std::vector<RPCServer> servers; // rpc servers in the cluster
-    std::vector<std::string> original_args; // cli arrguments from llama-cli
-    pid_t llama_process; // PID of llamacpp
-    std::mutex mtx; // thread mutex
-    bool should_continue; // control flag for continue loop
-    int original_ngl; // gpu layers from llama-cli
-    int stdout_pipe[2];
-    int stderr_pipe[2];
-    std::chrono::steady_clock::time_point last_output_time; // last output timer
+        if (config.server_mode()) {
+            args.add("--port");
+            args.add(std::to_string(backend.port));
+        }
+        if (new_ctx) {
+            args.add("-c");
+            args.add(std::to_string(rung.ctx));
+        }
+        if (new_batch) {
+            args.add("-b");
+            args.add(std::to_string(rung.batch));
+            args.add("-ub");
+            args.add(std::to_string(rung.batch));
+        }
+        if (new_model) {
+            args.add("-m");
+            args.add(rung.model);
+        }
+        if (with_session) {
+            args.add("--prompt-cache");
+            args.add(session_for(plan.level));
+        }
+        if (resuming) { // the new process picks up right after the last token we forwarded
+            args.add("-p");
+            args.add(resume.prompt + resume.generated());
+            args.add("--no-display-prompt");
+            int n_predict = find_int_arg(is_predict_arg, -1);
+            if (n_predict > 0) {
+                long left = std::max(1L, (long)n_predict - (long)resume.generated_tokens());
+                args.add("-n");
+                args.add(std::to_string(left));
+            }
+        }
 
-    std::string build_rpc_string() { // string of available RPC servers
-        std::string rpc_servers;
-        bool first = true;
-        for (auto& server : servers) { // for all servers
-            if (server.available) { // check if available
-                if (!first) rpc_servers += ","; // separate them
-                rpc_servers += server.address; //
-                first = false;
+        if (!is_fallback) { // add RPC and ngl arguments from command line
+            args.add("--rpc");
+            args.add(plan.rpc);
+            args.add("-ngl");
+            args.add(std::to_string(plan.ngl));
+            if (!plan.tensor_split.empty()) {
+                args.add("--tensor-split");
+                args.add(plan.tensor_split);
             }
+        } else {
+            args.add("-ngl");
+            args.add("0");  // if all RPC servers fail
         }
-        return rpc_servers;
     }
-    // builts to format "ip1:port1,ip2:port2, etc"
 
-    bool is_server_reachable(const std::string& ip, int port) { // open a TCP connection to see if server is reachable
-        int sockfd;
-        struct sockaddr_in serv_addr;
-        sockfd = socket(AF_INET, SOCK_STREAM, 0); // ipv4, tcp
-        if (sockfd < 0) { // check if socket creation failed
-            perror("socket");
+    // our end non-blocking, the child's end blocks like a normal stdout. packets: O_DIRECT on the child's end, each
+    // write() is read back on its own, which is how resume counts tokens. kernels before 3.4 refuse it, the count
+    // is a lower bound there
+    static bool child_pipe(int fds[2], bool packets = false) {
+        if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+            log_error("pipe2");
             return false;
         }
+        // separate file description from the read end. the writer's flags decide whether a write is a packet
+        if (!packets || fcntl(fds[1], F_SETFL, O_DIRECT) < 0) fcntl(fds[1], F_SETFL, 0);
+        fcntl(fds[0], F_SETPIPE_SZ, CHILD_PIPE_SIZE); // best effort, capped by /proc/sys/fs/pipe-max-size
+        return true;
+    }
+
+    // posix_spawn llama-cli with stdout and stderr on two fresh pipes, returns the pid and hands back the read ends.
+    // glibc spawns with CLONE_VFORK, nothing of the supervisor gets copied however many threads and buffers it has
+    pid_t spawn_llama(ArgvArena& args, int& out_fd, int& err_fd) {
+        int fds[2], err[2];
+        out_fd = -1;
+        err_fd = -1;
+        if (!child_pipe(fds, resume_enabled)) return -1;
+        if (!child_pipe(err)) {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
 
-        memset(&serv_addr, 0, sizeof(serv_addr)); // server address setup stuff
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(port); // convert port to network byte order
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO); // the copies lose O_CLOEXEC, the originals close
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO); // logs apart from tokens
 
-        if (inet_pton(AF_INET, ip.c_str(), &serv_addr.sin_addr) <= 0) { // IP is convered to binary
-            close(sockfd);
-            return false;
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t mask;
+        sigemptyset(&mask);
+        posix_spawnattr_setsigmask(&attr, &mask); // blocked masks survive exec, llama-cli needs its signals back
+        sigaddset(&mask, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr, &mask); // so does an ignored SIGPIPE
+        short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+        if (terminator.own_groups()) {
+            posix_spawnattr_setpgroup(&attr, 0); // its own group, so SIGKILL reaches everything it started
+            flags |= POSIX_SPAWN_SETPGROUP;
         }
+        posix_spawnattr_setflags(&attr, flags);
 
-        struct timeval tv;
-        tv.tv_sec = 5; // 5-second timeout
-        tv.tv_usec = 0;
-        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv); // set socket options for send and receive timeout
-        setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof tv);
+        char* const* argv = args.argv();
+        pid_t pid = -1;
+        int result = posix_spawn(&pid, argv[0], &actions, &attr, argv, environ); // exec failures come back here too
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        close(err[1]);
 
-        int result = connect(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)); // connect attempt
-        close(sockfd);
+        if (result != 0) {
+            errno = result;
+            log_error(("spawn " + config.llama_binary()).c_str());
+            close(fds[0]);
+            close(err[0]);
+            return -1;
+        }
+        out_fd = fds[0];
+        err_fd = err[0];
+        return pid;
+    }
+
+    void restart_llama(Backend& backend, RestartReason reason) { // relaunch one backend on what is left of its pool
+        if (backend.launching) return; // already replaced, the launch it is waiting on plans from the latest state
+        int index = &backend - backends.data();
+        backend.probing = false; // whatever the probe round says now, this process is being replaced
+        auto step = std::chrono::steady_clock::now();
+        if (reason != RestartReason::START) trace.begin(index, restart_reason_name(reason), step);
+        trace.instant(index, "restart", step, "\"reason\":\"" + std::string(restart_reason_name(reason)) + "\"");
+        if (proxy.enabled()) proxy.backend_down(index); // route around it until the replacement answers /health
+        trace.terminated(index, backend.process);
+        pid_t old_process = backend.process;
+        terminator.terminate(backend.process, "backend"); // reaped later, only the rpc check waits for it
+        backend.process = -1;
+        metrics.end_run(index, reason, std::chrono::steady_clock::now());
+
+        readmit_recovered(backend.pool); // fold in servers that came back, verify_rpc_servers() still gets the last word
+        readmit_pending = false;
+        step = trace_step(index, "terminate_and_readmit", step);
+        if (try_promote_standby()) return; // warm process already loaded for this topology
 
-        return result == 0; // return true if connection succeeded
+        if (!config.rpc_check) {
+            launch_backend(backend, reason, step);
+            return;
+        }
+        // only hand layers to servers that answer the protocol. rpc-server takes one client and a
+        // listen backlog of one, so the check waits until nothing we started is still connected to them
+        backend.replaced.clear();
+        if (old_process > 0) backend.replaced.push_back(old_process);
+        if (standby_process > 0 && !standby_rpc.empty()) {
+            backend.replaced.push_back(standby_process);
+            stop_standby();
+        }
+        backend.launching = true;
+        backend.launch_reason = reason;
+        backend.launch_step = step;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            backend.up = false; // nothing on its port until the launch, failures there mean nothing
+            backend.checked = false;
+        }
+        if (backend.replaced.empty()) request_rpc_check(backend);
     }
 
-    // inference status check
-    void check_inference_status() {
-        auto now = std::chrono::steady_clock::now(); // get current time
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-            now - last_output_time).count(); // calc time since last output
+    void request_rpc_check(Backend& backend) { // the check takes up to rpc_budget_ms, the monitor runs it and writes wake_fd
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            backend.check_requested = true;
+            launch_check_requested = true;
+        }
+        monitor_cv.notify_all();
+    }
+
+    void advance_launches() { // main loop: check replaced pools once their old children are reaped, launch once checked
+        for (auto& backend : backends) {
+            if (!backend.launching) continue;
+            int index = &backend - backends.data();
+            if (!backend.replaced.empty()) {
+                auto& held = backend.replaced;
+                held.erase(std::remove_if(held.begin(), held.end(), [this](pid_t pid) { return !terminator.holds(pid); }),
+                           held.end());
+                if (!held.empty()) continue; // SIGCHLD brings us back, escalate() bounds the wait
+                backend.launch_step = trace_step(index, "wait_reaped", backend.launch_step);
+                request_rpc_check(backend);
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!backend.checked) continue;
+            }
+            backend.launching = false;
+            auto step = trace_step(index, "verify_rpc_servers", backend.launch_step);
+            if (try_promote_standby()) continue; // the check may have left us on the standby's topology
+            launch_backend(backend, backend.launch_reason, step);
+        }
+    }
 
-        if (elapsed >= 5) { // restarts inference on remaining PIs if no server is available
-            std::cout << "\nNo output received for 5 seconds, attempting restart..." << std::endl;
+    void launch_backend(Backend& backend, RestartReason reason, std::chrono::steady_clock::time_point step) {
+        int index = &backend - backends.data();
+        if (backend.out_fd != -1) close(backend.out_fd); // pipe cleaning and reinstantiation
+        if (backend.err_fd != -1) close(backend.err_fd);
+        backend.out_fd = -1;
+        backend.err_fd = -1;
 
-            bool any_server_removed = false; // initialized server removal flag to false
-            for (auto& server : servers) {
-                if (server.available && !is_server_reachable(server.ip, server.port)) { // if server is marked available but can't be reached
-                    server.available = false;
-                    any_server_removed = true;
-                    std::cout << "Removing unreachable server " << server.address << " and trying again..." << std::endl;
-                    // mark unavailable, set removal flag, log removal
+        LaunchPlan plan;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            plan = plan_launch(backend.pool); // available servers and how to split layers across them
+            backend.generation = ++launches; // any /health result in flight belongs to the old process
+            backend.up = false;
+            backend.health_failures = 0;
+        }
+        if (!plan.tensor_split.empty()) {
+            event_log.emit("layer_split").field("pool", backend.pool).field("rpc", plan.rpc).field("ngl", plan.ngl)
+                .field("tensor_split", plan.tensor_split);
+        }
+        if (plan.level != backend.level) {
+            const Rung& rung = rungs[plan.level];
+            event_log.emit("ladder_step").field("pool", backend.pool).field("from", backend.level).field("to", plan.level)
+                .field("ctx", rung.ctx).field("batch", rung.batch).field("model", rung.model);
+        }
+        build_command_args(plan, backend, backend.args); // reuses the last command line if nothing changed
+        step = trace_step(index, "plan_launch", step);
+        if (reason != RestartReason::START) model_cache.rewarm(); // whatever was evicted since the last load
+        step = trace_step(index, "model_rewarm", step);
+        bool resumed = resume_enabled && resume.usable() && !resume.generated().empty();
+        if (resumed) {
+            event_log.emit("resume").field("generated_bytes", resume.generated().size())
+                .field("generated_tokens", resume.generated_tokens());
+        }
+        backend.process = spawn_llama(backend.args, backend.out_fd, backend.err_fd);
+        if (backend.process < 0) {
+            terminate_requested = 1; // the binary itself won't start, relaunching can't fix that
+            fatal_launch = true;
+            event_log.emit("launch_failed").field("pool", backend.pool).field("binary", config.llama_binary());
+            return;
+        }
+        step = trace_step(index, "spawn", step);
+        trace.spawned(index, backend.process, step, false);
+        event_log.emit("backend_started").field("pool", backend.pool).field("pid", backend.process).field("rpc", plan.rpc)
+            .field("ngl", plan.ngl).field("generation", backend.generation);
+        resume.start_process(!resumed);
+        commit_placement(plan, backend.pool);
+        backend.rpc = plan.rpc;
+        backend.ngl = plan.ngl;
+        backend.tensor_split = plan.tensor_split;
+        backend.level = plan.level;
+        backend.degraded = plan.level > 0 || plan.capped_from > 0 || plan.rpc.empty();
+        backend.kv_bytes = backend.compute_bytes = 0;
+        backend.log_ctx = backend.log_ubatch = 0;
+        update_degraded();
+        mark_in_use();
+        if (backend.out_fd != -1) watch_fd(backend.out_fd, EV_OUTPUT, index);
+        if (backend.err_fd != -1) watch_fd(backend.err_fd, EV_ERRLOG, index);
+        backend.log.reset();
+        sample_load_baseline(backend);
+
+        if (standby_process > 0 && topology_key(standby_rpc) == topology_key(backend.rpc)) stop_standby(); // it would just duplicate the primary
+        standby_gave_up = false;
+        backend.stall.reset(std::chrono::steady_clock::now()); // new process starts in the load phase
+        metrics.start_run(index, std::chrono::steady_clock::now());
+    }
+
+    bool standby_topology(LaunchPlan& plan) { // topology worth keeping warm, false if it would match the primary
+        if (config.standby == "cpu") {
+            plan = LaunchPlan();
+        } else {
+            // minus-one: assumes the likeliest next loss is the server that has looked worst lately.
+            // only useful with rpc-servers that accept a second client while the primary holds them
+            std::lock_guard<std::mutex> lock(mtx);
+            int worst = -1;
+            for (size_t i = 0; i < servers.size(); i++) {
+                if (!servers[i].available) continue;
+                if (worst < 0 || servers[i].consecutive_failures > servers[worst].consecutive_failures ||
+                    (servers[i].consecutive_failures == servers[worst].consecutive_failures &&
+                     servers[i].last_rtt_us > servers[worst].last_rtt_us)) {
+                    worst = (int)i;
                 }
             }
+            plan = plan_launch(0, worst); // everything but that one
+        }
+        return topology_key(plan.rpc) != topology_key(backends[0].rpc);
+    }
 
-            if (!any_server_removed) {
-                std::cout << "All RPC servers are reachable, but no output received. Restarting inference..." << std::endl; // for stalled inference
-            } else if (std::none_of(servers.begin(), servers.end(), [](const RPCServer& s){ return s.available; })) { // if all servers are unavailable
-                std::cout << "No reachable RPC servers available, falling back to CPU..." << std::endl; // fallback to cpu
-            }
+    void maybe_start_standby() { // launched once the primary is past its own load so the two don't fight over disk and CPU
+        if (config.standby == "off" || standby_process > 0 || standby_gave_up || backends[0].process <= 0) return;
+        if (backends[0].stall.phase() == RunPhase::LOAD) return;
 
-            restart_llama();
+        LaunchPlan plan;
+        if (!standby_topology(plan)) return;
+        const std::string& rpc = plan.rpc;
+
+        build_command_args(plan, backends[0], standby_args, false);
+        standby_process = spawn_llama(standby_args, standby_fd, standby_err_fd);
+        if (standby_process <= 0) {
+            standby_gave_up = true;
+            return;
         }
+        standby_rpc = rpc;
+        standby_ngl = plan.ngl;
+        standby_placement = plan.placement;
+        standby_level = plan.level;
+        standby_degraded = plan.level > 0 || plan.capped_from > 0 || plan.rpc.empty();
+        standby_ready = false;
+        standby_log.reset();
+        standby_stall.reset(std::chrono::steady_clock::now());
+        mark_in_use();
+        watch_fd(standby_err_fd, EV_STANDBY); // its stdout stays untouched in the pipe until promotion
+        event_log.emit("standby_loading").field("rpc", rpc.empty() ? "cpu" : rpc).field("pid", standby_process);
     }
 
-    std::vector<char*> build_command_args() { //extracts and rebuilds command line args from llama.cpp
-        std::vector<char*> args; // vector for cli arguments
-        args.push_back(strdup("./llama-cli")); // add exec name for first arg
+    void monitor_standby() { // watch the standby's load log and freeze it as soon as the load is done
+        char buffer[4096];
+        ssize_t n = read(standby_err_fd, buffer, sizeof(buffer));
+        if (n == 0) { // exited, reap_child() deals with it
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, standby_err_fd, nullptr);
+            return;
+        }
+        if (n < 0 || standby_ready) return;
 
-        bool skip_next = false; // skip args
-        std::string rpc_servers = build_rpc_string(); //get string of available servers
+        auto now = std::chrono::steady_clock::now();
+        standby_log.feed(buffer, n, [&](const std::string& line) { standby_stall.on_log_line(line, now); },
+                         [&](int) { standby_stall.on_progress(now); });
+        if (standby_stall.phase() == RunPhase::LOAD) return;
 
-        // Check if we have any available RPC servers, if not, fallback to CPU only
-        bool is_fallback = rpc_servers.empty();
+        kill(standby_process, SIGSTOP); // loaded, park it before it starts on the prompt
+        standby_ready = true;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, standby_err_fd, nullptr); // the rest of its log waits for promotion
+        event_log.emit("standby_parked").field("rpc", standby_rpc.empty() ? "cpu" : standby_rpc);
+    }
 
-        for (size_t i = 0; i < original_args.size(); i++) { // process all llama-cli arguments except RPC and NGL
-            if (skip_next) {
-                skip_next = false;
-                continue;
+    bool try_promote_standby() { // switch to the parked standby if it matches the topology we need now
+        if (!standby_ready) return false;
+        // the standby only knows the original prompt, a resumed cold start beats replaying everything
+        if (resume_enabled && resume.usable() && !resume.generated().empty()) return false;
+        std::string wanted;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            wanted = build_rpc_string();
+        }
+        if (topology_key(wanted) != topology_key(standby_rpc)) return false; // its order is baked in, that's fine
+
+        event_log.emit("standby_promoted").field("rpc", standby_rpc.empty() ? "cpu" : standby_rpc).field("pid", standby_process);
+        auto& primary = backends[0];
+        if (primary.out_fd != -1) close(primary.out_fd);
+        if (primary.err_fd != -1) close(primary.err_fd);
+        primary.process = standby_process;
+        primary.out_fd = standby_fd;
+        primary.err_fd = standby_err_fd;
+        primary.log = standby_log;
+        primary.rpc = standby_rpc;
+        primary.ngl = standby_ngl;
+        primary.tensor_split.clear(); // planned after n_layer was known, its placement is committed below
+        primary.level = standby_level;
+        primary.degraded = standby_degraded;
+        update_degraded();
+        LaunchPlan promoted;
+        promoted.placement = standby_placement;
+        commit_placement(promoted, 0);
+        standby_process = -1;
+        standby_fd = -1;
+        standby_err_fd = -1;
+        standby_ready = false;
+        standby_gave_up = false;
+
+        watch_fd(primary.out_fd, EV_OUTPUT, 0); // parked standbys aren't in the epoll set
+        watch_fd(primary.err_fd, EV_ERRLOG, 0);
+        kill(primary.process, SIGCONT);
+
+        auto now = std::chrono::steady_clock::now();
+        primary.stall.reset(now, RunPhase::PROMPT_EVAL); // already loaded
+        metrics.start_run(0, now, true);
+        trace.instant(0, "standby_promoted", now);
+        trace.spawned(0, primary.process, now, true);
+        mark_in_use();
+        resume.start_process(true); // whatever it wrote before the stop is still in its pipe
+        return true;
+    }
+
+    void stop_standby() {
+        terminator.terminate(standby_process, "standby");
+        if (standby_fd != -1) close(standby_fd);
+        if (standby_err_fd != -1) close(standby_err_fd);
+        standby_process = -1;
+        standby_fd = -1;
+        standby_err_fd = -1;
+        standby_ready = false;
+        mark_in_use();
+    }
+
+    void scan_load_log(const char* data, size_t n) { // picks "n_layer = 32" out of llama.cpp's model metadata dump
+        std::string chunk(data, n);
+        size_t pos = chunk.find("n_layer");
+        if (pos == std::string::npos) return;
+        pos = chunk.find_first_not_of(" \t=", pos + 7);
+        if (pos == std::string::npos || !isdigit((unsigned char)chunk[pos])) return;
+        model_layers = std::stoi(chunk.substr(pos));
+    }
+
+    static bool log_setting(const std::string& line, const char* key, double& value) { // "key = 123.4", not "key_train = ..."
+        for (size_t pos = line.find(key); pos != std::string::npos; pos = line.find(key, pos + 1)) {
+            size_t eq = line.find_first_not_of(' ', pos + strlen(key));
+            if (eq == std::string::npos || line[eq] != '=') continue;
+            const char* start = line.c_str() + eq + 1;
+            char* end;
+            value = strtod(start, &end);
+            if (end != start) return true;
+        }
+        return false;
+    }
+
+    // what this load costs the servers besides weights: llama.cpp reports a KV buffer and a compute buffer per
+    // device ("RPC[10.0.0.2:50052] KV buffer size = 104.00 MiB"), plus the n_ctx and n_ubatch it settled on
+    void scan_footprint(Backend& backend, const std::string& line) {
+        double value;
+        if (log_setting(line, "n_ctx", value)) backend.log_ctx = (int)value;
+        if (log_setting(line, "n_ubatch", value)) backend.log_ubatch = (int)value;
+        if (line.find("RPC[") == std::string::npos) return;
+        if (log_setting(line, "KV buffer size", value)) backend.kv_bytes += (uint64_t)(value * (1 << 20));
+        if (log_setting(line, "compute buffer size", value)) {
+            backend.compute_bytes = std::max(backend.compute_bytes, (uint64_t)(value * (1 << 20)));
+        }
+    }
+
+    void learn_footprint(const Backend& backend) { // the load got through, keep what it measured for the next plans
+        const Rung& rung = rungs[backend.level];
+        std::lock_guard<std::mutex> lock(mtx);
+        if (rung.ctx == 0 && backend.log_ctx > 0) seen_ctx = backend.log_ctx;
+        if (rung.batch == 0 && backend.log_ubatch > 0) seen_ubatch = backend.log_ubatch;
+        int layers = model_layers > 0 ? std::min(backend.ngl, model_layers + 1) : 0;
+        if (backend.kv_bytes > 0 && backend.log_ctx > 0 && layers > 0) {
+            kv_bytes_per_cell = (double)backend.kv_bytes / ((double)backend.log_ctx * layers);
+        }
+        if (backend.compute_bytes > 0 && backend.log_ubatch > 0) {
+            compute_bytes_per_token = (double)backend.compute_bytes / backend.log_ubatch;
+        }
+        if (backend.kv_bytes > 0 || backend.compute_bytes > 0) {
+            event_log.emit("load_footprint").field("pool", backend.pool).field("kv_mib", backend.kv_bytes >> 20)
+                .field("compute_mib", backend.compute_bytes >> 20).field("ctx", backend.log_ctx).field("ubatch", backend.log_ubatch);
+        }
+    }
+
+    bool write_all(int fd, const char* data, size_t n) { // single write in the common case, loops on short writes
+        while (n > 0) {
+            ssize_t w = write(fd, data, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EPIPE) terminate_requested = 1; // whoever reads our output went away
+                else log_error("write");
+                return false;
+            }
+            data += w;
+            n -= w;
+        }
+        return true;
+    }
+
+    // drain a backend's pipe and forward it, returns bytes read (0 on EOF, -1 if nothing was there)
+    ssize_t monitor_output(Backend& backend) {
+        auto now = std::chrono::steady_clock::now();
+        auto& stall = backend.stall;
+        int out_fd = backend.out_fd;
+        size_t index = &backend - backends.data();
+        RunPhase before = stall.phase();
+
+        int available = 0;
+        if (!stdout_is_tty && splice_ok && !stall.needs_content() && !resume_enabled &&
+            ioctl(out_fd, FIONREAD, &available) == 0 && available > 0) { // nobody needs the bytes, move them in the kernel
+            // splice only what is already there, so it can't block waiting on the child
+            ssize_t n = splice(out_fd, nullptr, STDOUT_FILENO, nullptr, available, SPLICE_F_MOVE);
+            if (n > 0) {
+                stall.on_output(nullptr, n, now);
+                metrics.on_output(index, before, stall.phase(), n, now);
+                if (trace.open(index) && metrics.current[index].generating) trace.in_service(index, now);
+                return n;
+            }
+            if (n < 0 && errno == EPIPE) {
+                terminate_requested = 1;
+                return -1;
             }
+            splice_ok = false; // EINVAL: stdout can't take splice, use read/write from now on
+        }
 
-            // Skip existing RPC and ngl arguments
-            if (original_args[i] == "--rpc" ||
-                original_args[i] == "-ngl" ||
-                original_args[i] == "--n-gpu-layers") {
-                skip_next = true;
-                continue;
+        size_t filled = 0;
+        ssize_t n = 0;
+        // read until the pipe is empty or the buffer is full. a packet pipe drops whatever of a packet doesn't fit
+        // the read, and a packet is at most PIPE_BUF, so stop while there's still room for a whole one
+        while (output_buffer.size() - filled >= PIPE_BUF) {
+            n = read(out_fd, output_buffer.data() + filled, output_buffer.size() - filled);
+            if (n <= 0) break;
+            stall.on_output(output_buffer.data() + filled, n, now);
+            metrics.on_output(index, before, stall.phase(), n, now);
+            before = stall.phase();
+            if (resume_enabled) resume.on_output(output_buffer.data() + filled, n);
+            if (stdout_is_tty) {
+                write_all(STDOUT_FILENO, output_buffer.data() + filled, n); // show tokens as they arrive
+            } else {
+                filled += n;
             }
+        }
+        if (filled > 0) write_all(STDOUT_FILENO, output_buffer.data(), filled); // one write for the whole drain
+        if (trace.open(index) && metrics.current[index].generating) trace.in_service(index, now);
 
-            args.push_back(strdup(original_args[i].c_str())); // add args to vector
+        if (n == 0) { // child closed its end, stop polling the pipe so epoll doesn't spin on the hangup
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, out_fd, nullptr);
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            log_error("read");
         }
+        return filled > 0 ? (ssize_t)filled : n;
+    }
 
-        if (!is_fallback) { // add RPC and ngl arguments from command line
-            args.push_back(strdup("--rpc"));
-            args.push_back(strdup(rpc_servers.c_str()));
-            args.push_back(strdup("-ngl"));
-            args.push_back(strdup(std::to_string(original_ngl).c_str()));
-        } else {
-            args.push_back(strdup("-ngl"));
-            args.push_back(strdup("0"));  // if all RPC servers fail
+    // the child's stderr: load log, progress dots and perf prints, parsed line by line for the end of the load,
+    // the layer count and the timings, then logged as events. none of it is forwarded or counts as output
+    void monitor_stderr(Backend& backend) {
+        char buffer[16384];
+        size_t index = &backend - backends.data();
+        ssize_t n;
+        while ((n = read(backend.err_fd, buffer, sizeof(buffer))) > 0) {
+            auto now = std::chrono::steady_clock::now();
+            if (!backend.load_sampled && !backend.rpc.empty() && backend.stall.phase() == RunPhase::LOAD) {
+                sample_load_baseline(backend); // until its first connection shows up
+            }
+            backend.log.feed(buffer, n, [&](const std::string& line) {
+                RunPhase before = backend.stall.phase();
+                if (before == RunPhase::LOAD && model_layers == 0) {
+                    scan_load_log(line.data(), line.size());
+                    if (model_layers > 0) commit_placement(launched_placement(backend), backend.pool); // launched blind
+                }
+                if (before == RunPhase::LOAD) scan_footprint(backend, line);
+                backend.stall.on_log_line(line, now);
+                trace.child_line(index, line, now);
+                if (before == RunPhase::LOAD && backend.stall.phase() != RunPhase::LOAD) {
+                    metrics.on_load_done(index, now);
+                    trace.loaded(index, now);
+                    learn_footprint(backend);
+                }
+                metrics.scan_perf(index, line.data(), line.size());
+                event_log.emit("child_log").field("pool", backend.pool).field("line", line);
+            }, [&](int percent) {
+                backend.stall.on_progress(now); // a slow load that is still moving isn't stalled
+                metrics.on_load_progress(index, percent);
+                if (percent % 25 == 0) event_log.emit("load_progress").field("pool", backend.pool).field("percent", percent);
+            });
         }
+        if (n == 0) { // closed with the process, reap_child() deals with that
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, backend.err_fd, nullptr);
+        } else if (errno != EAGAIN && errno != EINTR) {
+            log_error("read");
+        }
+    }
 
-        args.push_back(nullptr); // null term for execv
-        return args;
+    // after every wakeup, so the scraper never sees a run half updated. copying RunMetrics holds up the scraper, so
+    // while tokens stream it happens once per METRICS_PUBLISH_MS; a backend starting, stopping or changing phase
+    // goes out right away
+    void publish_metrics() {
+        if (!metrics_server.enabled()) return;
+        auto now = std::chrono::steady_clock::now();
+        if (now < metrics_due && !backends_changed()) {
+            metrics_pending = true;
+            return;
+        }
+        metrics_pending = false;
+        metrics_due = now + std::chrono::milliseconds(METRICS_PUBLISH_MS);
+        std::lock_guard<std::mutex> lock(snapshot_mtx);
+        metrics_snapshot = metrics;
+        backend_snapshot.resize(backends.size());
+        for (size_t i = 0; i < backends.size(); i++) {
+            auto& view = backend_snapshot[i];
+            view.pool = backends[i].pool;
+            view.pid = backends[i].process;
+            view.ngl = backends[i].ngl;
+            view.level = backends[i].level;
+            view.rpc = backends[i].rpc;
+            view.phase = backends[i].stall.phase_name();
+        }
     }
 
-    void restart_llama() {
-        if (llama_process > 0) {
-            kill(llama_process, SIGTERM); // kill llama.cli if it's already running
-            int status;
-            waitpid(llama_process, &status, 0);
+    bool backends_changed() const { // since the last publish
+        if (backend_snapshot.size() != backends.size()) return true;
+        for (size_t i = 0; i < backends.size(); i++) {
+            const auto& view = backend_snapshot[i];
+            const auto& backend = backends[i];
+            if (view.pid != backend.process || view.ngl != backend.ngl || view.level != backend.level ||
+                view.rpc != backend.rpc || view.phase != backend.stall.phase_name()) return true;
+        }
+        return false;
+    }
+
+    std::string render_metrics() { // runs on the scraper thread
+        RunMetrics m;
+        std::vector<BackendView> views;
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mtx);
+            m = metrics_snapshot;
+            views = backend_snapshot;
+        }
+        std::vector<RPCServer> nodes;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            nodes = servers;
+        }
+        auto now = std::chrono::steady_clock::now();
+
+        std::ostringstream out;
+        auto family = [&out](const char* name, const char* type, const char* help) {
+            out << "# HELP durable_llama_" << name << " " << help << "\n# TYPE durable_llama_" << name << " " << type << "\n";
+        };
+        auto server_labels = [](const RPCServer& node) {
+            return "{server=\"" + prometheus_label(node.address) + "\",pool=\"" + std::to_string(node.pool) + "\"} ";
+        };
+        auto pool_labels = [](int pool) { return "{pool=\"" + std::to_string(pool) + "\"} "; };
+
+        family("rpc_server_available", "gauge", "1 while the server is in its pool's --rpc list.");
+        for (const auto& node : nodes) out << "durable_llama_rpc_server_available" << server_labels(node) << node.available << "\n";
+        family("rpc_server_healthy", "gauge", "Result of the latest probe.");
+        for (const auto& node : nodes) out << "durable_llama_rpc_server_healthy" << server_labels(node) << node.healthy << "\n";
+        family("rpc_server_rtt_seconds", "gauge", "RTT of the latest successful probe.");
+        for (const auto& node : nodes) {
+            if (node.last_rtt_us >= 0) out << "durable_llama_rpc_server_rtt_seconds" << server_labels(node) << node.last_rtt_us / 1e6 << "\n";
+        }
+        family("rpc_server_consecutive_failures", "gauge", "Failed probes in a row.");
+        for (const auto& node : nodes) {
+            out << "durable_llama_rpc_server_consecutive_failures" << server_labels(node) << node.consecutive_failures << "\n";
+        }
+        family("rpc_server_readmissions_total", "counter", "Times the server was dropped and let back in.");
+        for (const auto& node : nodes) out << "durable_llama_rpc_server_readmissions_total" << server_labels(node) << node.readmissions << "\n";
+        family("rpc_server_failure_score", "gauge", "Decaying count of the server's recent failures.");
+        for (const auto& node : nodes) {
+            out << "durable_llama_rpc_server_failure_score" << server_labels(node) << node.score(now, config.score_half_life_s) << "\n";
+        }
+        family("rpc_server_free_bytes", "gauge", "Free device memory from the latest ggml-rpc check.");
+        for (const auto& node : nodes) {
+            if (node.free_mem > 0) out << "durable_llama_rpc_server_free_bytes" << server_labels(node) << node.free_mem << "\n";
+        }
+
+        family("backend_info", "gauge", "Topology and phase of each backend's current process.");
+        for (const auto& view : views) {
+            out << "durable_llama_backend_info{pool=\"" << view.pool << "\",rpc=\"" << prometheus_label(view.rpc) << "\",phase=\"" << view.phase << "\"} 1\n";
+        }
+        family("backend_ngl", "gauge", "-ngl the current process was launched with.");
+        for (const auto& view : views) out << "durable_llama_backend_ngl" << pool_labels(view.pool) << view.ngl << "\n";
+        family("backend_ladder_level", "gauge", "Degradation ladder rung of the current process, 0 for the command line as given.");
+        for (const auto& view : views) out << "durable_llama_backend_ladder_level" << pool_labels(view.pool) << view.level << "\n";
+        family("backend_pid", "gauge", "PID of the current process, -1 between launches.");
+        for (const auto& view : views) out << "durable_llama_backend_pid" << pool_labels(view.pool) << view.pid << "\n";
+        family("backend_uptime_seconds", "gauge", "Time since the current process was launched.");
+        for (size_t i = 0; i < views.size() && i < m.current.size(); i++) {
+            double up = m.current[i].active ? RunStats::seconds(now - m.current[i].started) : 0;
+            out << "durable_llama_backend_uptime_seconds" << pool_labels(views[i].pool) << up << "\n";
+        }
+        family("run_load_progress_ratio", "gauge", "Model load progress of the current run, from llama.cpp's progress output.");
+        for (size_t i = 0; i < views.size() && i < m.current.size(); i++) {
+            const auto& run = m.current[i];
+            if (!run.active || (run.load_percent < 0 && !run.load_done)) continue;
+            out << "durable_llama_run_load_progress_ratio" << pool_labels(views[i].pool)
+                << (run.load_done ? 1.0 : run.load_percent / 100.0) << "\n";
+        }
+        family("run_load_seconds", "gauge", "Load time of the current run.");
+        for (size_t i = 0; i < views.size() && i < m.current.size(); i++) {
+            out << "durable_llama_run_load_seconds" << pool_labels(views[i].pool) << m.current[i].load_s() << "\n";
+        }
+        family("run_time_to_first_token_seconds", "gauge", "From the end of the load to the first token, current run.");
+        for (size_t i = 0; i < views.size() && i < m.current.size(); i++) {
+            out << "durable_llama_run_time_to_first_token_seconds" << pool_labels(views[i].pool) << m.current[i].ttft_s() << "\n";
+        }
+        family("run_tokens_per_second", "gauge", "Generation throughput of the current run.");
+        for (size_t i = 0; i < views.size() && i < m.current.size(); i++) {
+            out << "durable_llama_run_tokens_per_second" << pool_labels(views[i].pool) << m.current[i].tokens_per_s() << "\n";
         }
 
-        if (stdout_pipe[0] != -1) close(stdout_pipe[0]); // pipe cleaning and reinstantiation
-        if (stdout_pipe[1] != -1) close(stdout_pipe[1]);
+        LatencyHistogram itl = m.itl; // the runs still going count too, so dashboards don't wait for a restart
+        uint64_t tokens = m.tokens;
+        double generation_s = m.generation_s;
+        for (const auto& run : m.current) {
+            if (!run.active) continue;
+            itl.merge(run.itl);
+            tokens += run.tokens();
+            generation_s += run.generation_s();
+        }
 
-        pipe(stdout_pipe);
+        family("runs_total", "counter", "Finished runs.");
+        out << "durable_llama_runs_total " << m.runs << "\n";
+        family("restarts_total", "counter", "Restarts by reason.");
+        for (int r = (int)RestartReason::STALLED; r <= (int)RestartReason::READMIT; r++) {
+            out << "durable_llama_restarts_total{reason=\"" << restart_reason_name((RestartReason)r) << "\"} " << m.restart_counts[r] << "\n";
+        }
+        family("tokens_total", "counter", "Tokens generated.");
+        out << "durable_llama_tokens_total " << tokens << "\n";
+        family("generation_seconds_total", "counter", "Time spent generating.");
+        out << "durable_llama_generation_seconds_total " << generation_s << "\n";
+        if (!config.batch_path.empty()) {
+            family("batch_jobs", "gauge", "Batch jobs by state, skipped ones finished on an earlier run.");
+            size_t settled = batch.jobs_skipped() + batch.jobs_succeeded() + batch.jobs_failed();
+            out << "durable_llama_batch_jobs{state=\"skipped\"} " << batch.jobs_skipped() << "\n";
+            out << "durable_llama_batch_jobs{state=\"succeeded\"} " << batch.jobs_succeeded() << "\n";
+            out << "durable_llama_batch_jobs{state=\"failed\"} " << batch.jobs_failed() << "\n";
+            out << "durable_llama_batch_jobs{state=\"pending\"} " << batch.jobs() - std::min(batch.jobs(), settled) << "\n";
+        }
+        family("failovers_total", "counter", "Outages that ended with the backend useful again.");
+        out << "durable_llama_failovers_total " << m.failovers << "\n";
+        family("downtime_seconds_total", "counter", "Time from a failure to the first token or /health 200 after it.");
+        out << "durable_llama_downtime_seconds_total " << m.downtime_s << "\n";
+        family("last_downtime_seconds", "gauge", "Downtime of the latest failover.");
+        out << "durable_llama_last_downtime_seconds " << m.last_downtime_s << "\n";
 
-        auto args = build_command_args(); // build argument array for new process
+        family("inter_token_latency_seconds", "histogram", "Gaps between generated tokens.");
+        uint64_t cumulative = 0;
+        for (int b = 0; b + 1 < LatencyHistogram::BUCKETS; b++) {
+            cumulative += itl.bucket_count(b);
+            out << "durable_llama_inter_token_latency_seconds_bucket{le=\"" << LatencyHistogram::upper_ms(b) / 1000
+                << "\"} " << cumulative << "\n";
+        }
+        out << "durable_llama_inter_token_latency_seconds_bucket{le=\"+Inf\"} " << itl.count() << "\n";
+        out << "durable_llama_inter_token_latency_seconds_sum " << itl.sum() / 1000 << "\n";
+        out << "durable_llama_inter_token_latency_seconds_count " << itl.count() << "\n";
+        return out.str();
+    }
 
-        llama_process = fork(); // fork and execute llama-cli binary
-        if (llama_process == 0) { // if code runs in child proccess
-            dup2(stdout_pipe[1], STDOUT_FILENO);
-            dup2(stdout_pipe[1], STDERR_FILENO); // redirect stderr to stdout
-            close(stdout_pipe[0]);
-            close(stdout_pipe[1]); //close pipe
+    void watch_fd(int fd, EventSource source, int backend = 0) { // add a descriptor to the epoll set
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = source | (uint32_t)backend << 8;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) log_error("epoll_ctl");
+    }
 
-            execv("./llama-cli", args.data()); //replace child process with llama-cli
-            perror("execv failed");
+    void setup_event_loop() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        sigset_t mask = supervisor_signals(); // already blocked by main()
+        signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || signal_fd < 0 || timer_fd < 0 || wake_fd < 0) {
+            log_error("event loop setup");
             exit(1);
         }
+        watch_fd(signal_fd, EV_SIGNAL);
+        watch_fd(timer_fd, EV_TIMER);
+        watch_fd(wake_fd, EV_WAKE);
+    }
+
+    void arm_stall_timer() { // keep timer_fd at or before the earliest stall or kill deadline
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        for (const auto& backend : backends) {
+            if (backend.process > 0 && !backend.probing) deadline = std::min(deadline, backend.stall.deadline());
+        }
+        deadline = std::min(deadline, terminator.deadline()); // SIGKILL for a child that ignored SIGTERM
+        if (metrics_pending) deadline = std::min(deadline, metrics_due); // what the last publish_metrics() held back
+        if (deadline == std::chrono::steady_clock::time_point::max()) return;
+        if (timer_armed && deadline >= armed_deadline) return; // an earlier wakeup is already set, it re-arms when it fires
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1; // zero would disarm
+        // steady_clock is CLOCK_MONOTONIC on Linux, so the deadline can be used as an absolute time
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+        armed_deadline = deadline;
+        timer_armed = true;
+    }
 
-        close(stdout_pipe[1]); //non-blocking IO stuff
+    void handle_signals() { // drain the signalfd
+        struct signalfd_siginfo info;
+        while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) terminate_requested = 1;
+            if (info.ssi_signo == SIGHUP) {
+                // with nothing to reload keep the default meaning of a hangup instead of swallowing it
+                if (config.cluster_path.empty()) terminate_requested = 1;
+                else reload_cluster();
+            }
+            // SIGCHLD needs nothing here, reap_child() runs after every wakeup
+        }
+    }
 
-        fcntl(stdout_pipe[0], F_SETFL, O_NONBLOCK);
+    // SIGHUP: re-read the cluster file. new nodes and changed settings count from the next launch, nothing is
+    // restarted for them, so the loaded model stays up. removed nodes are retired; a running process keeps
+    // using them until it's replaced
+    void reload_cluster() {
+        std::vector<NodeSpec> nodes;
+        std::string error;
+        if (!ClusterFile::load(config.cluster_path, nodes, error)) {
+            event_log.emit("cluster_reload_failed").field("error", error);
+            return;
+        }
+        int added = 0, removed = 0, updated = 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& server : servers) {
+            if (server.retired) continue;
+            if (std::none_of(nodes.begin(), nodes.end(), [&](const NodeSpec& n) { return n.address == server.address; })) {
+                server.retired = true;
+                server.available = false;
+                removed++;
+                event_log.emit("server_removed").field("server", server.address).field("reason", "config");
+            }
+        }
+        for (const auto& node : nodes) {
+            auto it = std::find_if(servers.begin(), servers.end(), [&](const RPCServer& s) { return s.address == node.address; });
+            if (it == servers.end()) { // appended, the monitor's snapshot and every index stay valid
+                int pool = smallest_pool();
+                servers.emplace_back(node);
+                resolver.watch(servers.back().ip); // unresolved names probe as down until the lookup lands
+                it = servers.end() - 1;
+                it->pool = pool;
+                added++;
+            } else if (it->retired) { // back in the file, the next launch's RPC check vets it
+                it->retired = false;
+                it->available = true;
+                it->spec = node;
+                added++;
+            } else {
+                it->spec = node;
+                updated++;
+            }
+            if (node.pool >= 0) it->pool = std::min(node.pool, (int)backends.size() - 1);
+        }
+        event_log.emit("cluster_reloaded").field("added", added).field("removed", removed).field("updated", updated)
+            .field("servers", (long)std::count_if(servers.begin(), servers.end(), [](const RPCServer& s) { return !s.retired; }));
+    }
 
-        for (char* arg : args) { // free up arg memory
-            if (arg) free(arg);
+    int smallest_pool() { // caller holds mtx
+        std::vector<int> sizes(backends.size(), 0);
+        for (const auto& server : servers) {
+            if (!server.retired) sizes[server.pool]++;
         }
+        return std::min_element(sizes.begin(), sizes.end()) - sizes.begin();
+    }
 
-        last_output_time = std::chrono::steady_clock::now(); // check if inference is still working
+    // a load that died most likely ran out of memory: the next launch on the same servers starts a rung further
+    // down the ladder, and once the ladder is used up it offloads a fifth fewer layers instead of going to -ngl 0.
+    // either one lasts until backoff_expired() says memory has come back
+    void back_off(const Backend& backend) {
+        std::lock_guard<std::mutex> lock(mtx);
+        Backoff backoff;
+        backoff.since = std::chrono::steady_clock::now();
+        backoff.free_mem = topology_free(backend.rpc);
+        if (backend.level + 1 < (int)rungs.size()) {
+            Backoff& floor = ladder_floor[topology_key(backend.rpc)];
+            backoff.limit = std::max(floor.limit, backend.level + 1);
+            floor = backoff;
+            event_log.emit("ladder_backoff").field("pool", backend.pool).field("from", backend.level).field("to", floor.limit);
+            return;
+        }
+        int used = backend.ngl;
+        if (model_layers > 0) used = std::min(used, model_layers + 1);
+        backoff.limit = std::max(1, used * 4 / 5);
+        ngl_ceiling = backoff;
+        ceiling_rpc = backend.rpc;
+        event_log.emit("ngl_backoff").field("pool", backend.pool).field("from", backend.ngl).field("to", ngl_ceiling.limit);
     }
 
+    void reap_child() { // see if process is terminated
+        terminator.reap(); // replaced children first, their pids are no longer anyone's
+        int status;
+        if (standby_process > 0 && waitpid(standby_process, &status, WNOHANG) == standby_process) {
+            event_log.emit("standby_exited");
+            standby_process = -1; // already reaped
+            stop_standby();
+            standby_gave_up = true;
+        }
+
+        for (auto& backend : backends) {
+            if (backend.process <= 0) continue;
+            pid_t result = waitpid(backend.process, &status, WNOHANG); // non-blocking check
+            if (result != backend.process) continue;
 
-    void monitor_output() { // read and handle output from llama-cli process
-        fd_set read_fds;
-        struct timeval tv;
-        int retval; //file descriptor set, timeout struct, and return value for select()
+            while (monitor_output(backend) > 0) {} // forward whatever the child wrote before it died
+            monitor_stderr(backend); // and log why, if it said
+            backend.process = -1;
 
-        FD_ZERO(&read_fds);
-        FD_SET(stdout_pipe[0], &read_fds); // init file descriptor sedd and add pipe read end
+            if (WIFEXITED(status)) {
+                int exit_status = WEXITSTATUS(status);
+                event_log.emit("backend_exited").field("pool", backend.pool).field("status", exit_status);
+                if (exit_status == 0 && !config.server_mode()) { // a server exiting is always a failure
+                    // Inference completed successfully
+                    metrics.end_run(&backend - backends.data(), RestartReason::COMPLETED, std::chrono::steady_clock::now());
+                    should_continue = false;
+                    return;
+                }
+                // Non-zero exit status, restart
+                if (backend.stall.phase() == RunPhase::LOAD && backend.ngl > 1) back_off(backend); // most likely ran out of memory
+                restart_llama(backend, RestartReason::EXIT);
+            } else if (WIFSIGNALED(status)) {
+                event_log.emit("backend_killed").field("pool", backend.pool).field("signal", WTERMSIG(status));
+                restart_llama(backend, RestartReason::SIGNAL);
+            }
+        }
+    }
+
+    template <typename Match>
+    int find_int_arg(Match match, int fallback) { // value of the first matching option, or fallback
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
+            if (match(original_args[i])) return std::stoi(original_args[i + 1]);
+        }
+        return fallback;
+    }
+
+    std::string find_prompt() { // text of -p, or the contents of -f
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
+            if (original_args[i] == "-p" || original_args[i] == "--prompt") return original_args[i + 1];
+            if (original_args[i] == "-f" || original_args[i] == "--file") {
+                std::ifstream in(original_args[i + 1], std::ios::binary);
+                std::stringstream contents;
+                contents << in.rdbuf();
+                return contents.str();
+            }
+        }
+        return "";
+    }
 
+    bool is_interactive() { // resume can't replay a conversation
+        for (const auto& arg : original_args) {
+            if (arg == "-i" || arg == "--interactive" || arg == "-if" || arg == "--interactive-first" ||
+                arg == "-cnv" || arg == "--conversation") return true;
+        }
+        return false;
+    }
 
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
+    void setup_resume() {
+        resume.prompt = find_prompt();
+        resume_enabled = config.resume && !resume.prompt.empty() && !is_interactive() && !config.server_mode();
+        if (config.resume && !resume_enabled) {
+            event_log.emit("resume_disabled").field("reason", "needs llama-cli with a non-interactive -p or -f prompt");
+        }
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
+            if (original_args[i] == "--prompt-cache") session_path = original_args[i + 1]; // user's own cache
+        }
+        own_session = session_path.empty();
+        if (own_session) session_path = config.session_dir + "/durable-llama-" + std::to_string(getpid()) + ".session";
+    }
 
-        retval = select(stdout_pipe[0] + 1, &read_fds, NULL, NULL, &tv); // wait for data pipe
+    void setup_ladder() { // after the model cache, so rung 0 points at the staged copy
+        Rung base;
+        base.ctx = find_int_arg([](const std::string& a) { return a == "-c" || a == "--ctx-size"; }, 0);
+        base.batch = find_int_arg([](const std::string& a) { return a == "-ub" || a == "--ubatch-size"; }, 0);
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
+            if (original_args[i] == "-m" || original_args[i] == "--model") base.model = original_args[i + 1];
+        }
+        base.model_bytes = model_bytes;
+        rungs.push_back(base);
+        for (const auto& step : config.ladder) {
+            Rung rung = rungs.back();
+            if (step.ctx) rung.ctx = step.ctx;
+            if (step.batch) rung.batch = step.batch;
+            if (!step.model.empty()) {
+                struct stat st;
+                rung.model = step.model;
+                rung.model_bytes = stat(step.model.c_str(), &st) == 0 ? st.st_size : 0;
+                if (rung.model_bytes == 0) { // can't size it, and llama-cli couldn't load it either
+                    event_log.emit("ladder_step_skipped").field("model", step.model).field("reason", "unreadable");
+                    continue;
+                }
+            }
+            rungs.push_back(rung);
+        }
+    }
 
-        if (retval == -1) {
-            perror("select()"); // error handling
-        } else if (retval > 0) { //read and display output from llama-cli's inference engine
-            if (FD_ISSET(stdout_pipe[0], &read_fds)) {
-                char buffer[4096];
-                ssize_t n = read(stdout_pipe[0], buffer, sizeof(buffer) - 1); // create buffer and read tokens from pipe
-                if (n > 0) {
-                    buffer[n] = '\0'; // if data was read, null term string
-                    std::cout << buffer << std::flush;
-                    last_output_time = std::chrono::steady_clock::now(); // ouput toks and update output timestamp
+    // one "address score unix-time" line per server. they decay by the wall-clock time since they were
+    // written, so a node that failed yesterday starts today nearly clean
+    void load_scores() {
+        if (config.score_file == "off") return;
+        score_path = config.score_file.empty() ? config.session_dir + "/durable-llama.scores" : config.score_file;
+        std::ifstream in(score_path);
+        std::string address;
+        double score;
+        long long written;
+        time_t wall = time(nullptr);
+        while (in >> address >> score >> written) {
+            for (auto& server : servers) {
+                if (server.address != address) continue;
+                server.failure_score = score * std::exp2(-std::max(0.0, (double)(wall - written)) / config.score_half_life_s);
+                if (server.failure_score >= 0.01) {
+                    event_log.emit("score_loaded").field("server", address).field("score", server.failure_score);
                 }
             }
         }
     }
 
+    void save_scores() { // renamed into place, a crash mid-write leaves the previous file
+        if (score_path.empty()) return;
+        std::ostringstream out;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto now = std::chrono::steady_clock::now();
+            for (const auto& server : servers) {
+                double score = server.score(now, config.score_half_life_s);
+                if (score >= 0.01) out << server.address << " " << score << " " << (long long)time(nullptr) << "\n";
+            }
+        }
+        std::string tmp = score_path + ".tmp";
+        std::ofstream file(tmp, std::ios::trunc);
+        file << out.str();
+        file.close();
+        if (!file || rename(tmp.c_str(), score_path.c_str()) < 0) log_error("save scores");
+    }
+
+    std::string session_for(int level) const { // a prompt cache only fits the model that wrote it
+        if (level == 0 || rungs[level].model == rungs[0].model) return session_path;
+        return session_path + "." + std::to_string(level);
+    }
+
+    uint64_t find_model_size() { // bytes in the -m file, used to size layers
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
+            if (original_args[i] == "-m" || original_args[i] == "--model") {
+                struct stat st;
+                if (stat(original_args[i + 1].c_str(), &st) == 0) return st.st_size;
+            }
+        }
+        return 0;
+    }
+
+    // splits the servers into contiguous pools, one backend each. llama-server's own --host/--port
+    // is where the first one listens, the others take the ports after it
+    void setup_backends() {
+        int pools = 1;
+        if (config.pools > 1 && !config.server_mode()) {
+            event_log.emit("option_ignored").field("option", "--dl-pools").field("reason", "needs --dl-mode server");
+        } else {
+            pools = std::max(1, std::min(config.pools, (int)servers.size()));
+        }
+        for (size_t i = 0; i < servers.size(); i++) {
+            servers[i].pool = servers[i].spec.pool >= 0 ? std::min(servers[i].spec.pool, pools - 1) : i * pools / servers.size();
+        }
+
+        std::string host = "127.0.0.1";
+        int port = 8080; // llama-server defaults
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
+            if (original_args[i] == "--host") host = original_args[i + 1];
+            if (original_args[i] == "--port") port = std::stoi(original_args[i + 1]);
+        }
+        if (host == "0.0.0.0" || host == "localhost") host = "127.0.0.1"; // probe it locally
+        if (host == "::") host = "::1";
+        if (config.server_mode()) resolver.watch(host); // a name resolves like the rpc servers' do
+
+        backends.reserve(pools);
+        for (int p = 0; p < pools; p++) {
+            backends.emplace_back(p, config);
+            backends.back().host = host;
+            backends.back().port = port + p;
+        }
+        metrics.resize(pools);
+    }
 
     int find_ngl_value() { // get gpu layers from CLI arguments
-        for (size_t i = 0; i < original_args.size() - 1; i++) {
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
             if (original_args[i] == "-ngl" || original_args[i] == "--n-gpu-layers") {
                 return std::stoi(original_args[i + 1]);
             }
@@ -253,67 +4820,251 @@ private:
     }
 
 public:
-    DurableLLaMA(const std::vector<std::string>& server_addresses, int argc, char** argv) // constructor for server addresses andd CLI args
-        : llama_process(-1), // start with invalid process ID
-          should_continue(true) { // set continue flag to true
+    DurableLLaMA(const std::vector<NodeSpec>& nodes, const std::vector<std::string>& llama_args,
+                 const SupervisorConfig& supervisor_config) // constructor for the nodes, llama-cli args and wrapper options
+        : original_args(llama_args), // store command line args
+          config(supervisor_config),
+          monitor_running(false),
+          topology_changed(false),
+          readmit_pending(false),
+          stall_probe_requested(false),
+          stall_probe_lost(false),
+          stall_probe_done(false),
+          launch_check_requested(false),
+          launches(0),
+          health_changed(false),
+          terminator(config.kill_grace_ms, !isatty(STDIN_FILENO)), // a child in its own group can't read the terminal
+          metrics_pending(false),
+          proxy(config),
+          should_continue(true), // set continue flag to true
+          fatal_launch(false),
+          epoll_fd(-1),
+          signal_fd(-1),
+          timer_fd(-1),
+          wake_fd(-1),
+          timer_armed(false),
+          output_buffer(OUTPUT_BUFFER_SIZE),
+          stdout_is_tty(isatty(STDOUT_FILENO)),
+          splice_ok(true),
+          standby_process(-1),
+          standby_fd(-1),
+          standby_err_fd(-1),
+          standby_ngl(0),
+          standby_level(0),
+          standby_degraded(false),
+          standby_ready(false),
+          standby_gave_up(false),
+          standby_stall(config),
+          resume_enabled(false),
+          own_session(false),
+          model_bytes(0),
+          model_layers(0),
+          degraded(false),
+          kv_bytes_per_cell(0),
+          compute_bytes_per_token(0),
+          seen_ctx(0),
+          seen_ubatch(0),
+          scores_dirty(false),
+          user_split(false) {
 
-        for (const auto& addr : server_addresses) { // create rpc server objects for each address and add to server vectors
-            servers.emplace_back(addr); // construct object in place
+        for (const auto& node : nodes) { // create rpc server objects for each node and add to server vectors
+            servers.emplace_back(node); // construct object in place
         }
-
-        for (int i = 1; i < argc; i++) { // store command line args
-            original_args.push_back(argv[i]);
+        resolver.start(config.dns_ttl_ms);
+        for (const auto& server : servers) resolver.watch(server.ip);
+        resolver.wait_resolved(std::chrono::milliseconds(RESOLVE_WAIT_MS)); // the one lookup anyone waits for
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            refresh_endpoints();
         }
 
         original_ngl = find_ngl_value(); // get gpu layers
-        stdout_pipe[0] = stdout_pipe[1] = -1;
-        stderr_pipe[0] = stderr_pipe[1] = -1; // initialize pipe descriptors (no valid fd)
-        last_output_time = std::chrono::steady_clock::now(); // initialize timestamp to current time
+        for (const auto& arg : original_args) {
+            if (arg == "-ts" || arg == "--tensor-split") user_split = true;
+        }
+        all_rpc = build_rpc_string(); // before the split into pools
+        setup_backends();
+        if (config.server_mode() && config.standby != "off") {
+            event_log.emit("option_ignored").field("option", "--dl-standby").field("reason", "llama-cli only");
+            config.standby = "off";
+        }
+        model_bytes = find_model_size();
+        setup_model_cache();
+        setup_ladder();
+        load_scores();
+        setup_resume();
+    }
+
+    void setup_model_cache() { // before the first launch, so even it reads the staged copy
+        for (size_t i = 0; i + 1 < original_args.size(); i++) {
+            if (original_args[i] != "-m" && original_args[i] != "--model") continue;
+            if (!config.model_stage.empty()) original_args[i + 1] = model_cache.stage(original_args[i + 1], config.model_stage);
+            model_cache.start(original_args[i + 1], config.model_cache);
+            return;
+        }
+    }
+
+    bool batch_failed() const { // for the exit status: a job that never got a 200, or a batch cut short
+        return !config.batch_path.empty() && (batch.jobs_failed() > 0 || !batch.is_finished());
     }
 
+    bool launch_failed() const { return fatal_launch; } // for the exit status too
+
     void run() {
-        restart_llama(); // start llama-cli process
+        setup_event_loop();
+        if (!config.trace_dir.empty()) {
+            if (mkdir(config.trace_dir.c_str(), 0755) < 0 && errno != EEXIST) log_error(("trace " + config.trace_dir).c_str());
+            trace.start(config.trace_dir, backends.size());
+            terminator.on_reaped = [this](pid_t pid, std::chrono::steady_clock::time_point since,
+                                          std::chrono::steady_clock::time_point now, bool killed) {
+                trace.reaped(pid, since, now, killed);
+            };
+        }
+        if (!config.batch_path.empty() && config.listen.empty() && !proxy.start("", backends.size())) exit(1);
+        if (!config.listen.empty()) {
+            if (!config.server_mode()) {
+                event_log.emit("option_ignored").field("option", "--dl-listen").field("reason", "needs --dl-mode server");
+            } else if (proxy.start(config.listen, backends.size())) {
+                watch_fd(proxy.fd(), EV_PROXY);
+                event_log.emit("proxy_listening").field("address", config.listen).field("backends", backends.size())
+                    .field("first_port", backends[0].port);
+            } else {
+                exit(1);
+            }
+        }
+        if (!config.metrics_listen.empty()) {
+            if (!metrics_server.start(config.metrics_listen, [this] { return render_metrics(); })) exit(1);
+            event_log.emit("metrics_listening").field("address", config.metrics_listen);
+        }
+        if (!config.batch_path.empty()) { // queued now, sent as soon as a backend answers /health
+            std::string out = config.batch_out;
+            if (out.empty()) { // next to the file, or next to the directory rather than inside it
+                out = config.batch_path;
+                while (out.size() > 1 && out.back() == '/') out.pop_back();
+                out += ".results.jsonl";
+            }
+            if (!batch.start(config.batch_path, out, config.proxy_inflight * (int)backends.size(), proxy, wake_fd)) exit(1);
+        }
+        for (auto& backend : backends) restart_llama(backend, RestartReason::START); // start llama-cli processes
+        publish_metrics();
+        monitor_running = true;
+        monitor_thread = std::thread(&DurableLLaMA::health_monitor_loop, this);
         while (should_continue && !terminate_requested) { // loop until terminated
-            monitor_output();
-            check_inference_status(); // see if inference is still running
-            int status; // see if process is terminated
-            pid_t result = waitpid(llama_process, &status, WNOHANG); // non-blocking check
-
-            if (result == llama_process) { // if terminated
-                if (WIFEXITED(status)) {
-                    int exit_status = WEXITSTATUS(status);
-                    std::cout << "LLaMA process exited with status " << exit_status << "." << std::endl;
-                    if (exit_status == 0) {
-                        // Inference completed successfully
-                        should_continue = false;
-                    } else {
-                        // Non-zero exit status, restart
-                        std::cout << "LLaMA process exited with non-zero status. Restarting..." << std::endl;
-                        restart_llama();
-                    }
-                } else if (WIFSIGNALED(status)) {
-                    std::cout << "LLaMA process was terminated by a signal. Restarting..." << std::endl;
-                    restart_llama();
+            arm_stall_timer();
+            struct epoll_event events[8];
+            int n = epoll_wait(epoll_fd, events, 8, -1); // sleep until something actually happens
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                log_error("epoll_wait");
+                break;
+            }
+
+            bool child_event = false;
+            for (int i = 0; i < n; i++) {
+                uint64_t count;
+                switch (events[i].data.u32 & 0xff) {
+                    case EV_OUTPUT: // read and display output from llama-cli's inference engine
+                        monitor_output(backends[events[i].data.u32 >> 8]);
+                        break;
+                    case EV_ERRLOG:
+                        monitor_stderr(backends[events[i].data.u32 >> 8]);
+                        break;
+                    case EV_SIGNAL:
+                        handle_signals();
+                        child_event = true;
+                        break;
+                    case EV_TIMER:
+                        if (read(timer_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) log_error("timerfd read");
+                        timer_armed = false; // re-armed at the top of the loop
+                        break;
+                    case EV_WAKE:
+                        if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) log_error("eventfd read");
+                        break;
+                    case EV_STANDBY:
+                        monitor_standby();
+                        break;
+                    case EV_PROXY:
+                        proxy.accept_pending();
+                        break;
                 }
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            if (terminate_requested || batch.is_finished()) break;
+            if (child_event) reap_child();
+            terminator.escalate(std::chrono::steady_clock::now());
+            if (!should_continue) break;
+            advance_launches(); // replacements whose rpc check is in
+            check_inference_status(); // see if inference is still running
+            publish_metrics();
         }
         // Clean up before exiting
-        if (llama_process > 0) {
-            kill(llama_process, SIGTERM);
-            int status;
-            waitpid(llama_process, &status, 0);
+        batch.stop(); // anything in flight from here on is cut short, not answered
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            monitor_running = false;
+        }
+        monitor_cv.notify_all();
+        monitor_thread.join();
+        resolver.stop();
+
+        stop_standby();
+        for (auto& backend : backends) {
+            if (backend.process <= 0) continue;
+            terminator.terminate(backend.process, "backend");
+            backend.process = -1;
+            metrics.end_run(&backend - backends.data(), RestartReason::SHUTDOWN, std::chrono::steady_clock::now());
+        }
+        terminator.drain(); // bounded, a child stuck in recv() on a dead server gets SIGKILL
+        trace.stop(std::chrono::steady_clock::now()); // outages still open, marked unfinished
+        model_cache.stop(); // unpins
+        if (!config.model_stage_keep) model_cache.unstage(); // otherwise it stays for the next run
+        save_scores(); // decayed to now, the next run picks up from here
+        proxy.stop();
+        batch.join();
+        metrics_server.stop();
+        metrics.log_totals(); // after the backend, so no worker is left waiting on an answer
+
+        for (int fd : {epoll_fd, signal_fd, timer_fd, wake_fd}) {
+            if (fd >= 0) close(fd);
+        }
+        if (resume_enabled && own_session) { // per-run caches, nothing else will use them
+            for (size_t level = 0; level < rungs.size(); level++) unlink(session_for(level).c_str());
         }
     }
 };
 
+static void print_usage(const char* program) { // every option parse_option() takes, grouped by what it tunes
+    std::cerr << "Usage: " << program << " [llama.cpp options] --rpc server1:port1,server2:port2,...\n"
+              << "  probing:  [--dl-probe-interval ms] [--dl-probe-timeout ms] [--dl-fail-threshold n]"
+              << " [--dl-rpc-check 0|1] [--dl-rpc-budget ms]\n"
+              << "  stalls:   [--dl-load-timeout ms] [--dl-prompt-timeout ms] [--dl-stall-multiplier x]"
+              << " [--dl-stall-floor ms] [--dl-stall-fallback ms] [--dl-kill-grace ms]\n"
+              << "  resume:   [--dl-resume 0|1] [--dl-session-dir dir] [--dl-rebalance 0|1] [--dl-mem-headroom fraction]\n"
+              << "  server:   [--dl-mode cli|server] [--dl-binary path] [--dl-listen host:port] [--dl-max-inflight n]"
+              << " [--dl-queue n] [--dl-replay-timeout ms] [--dl-pools n]\n"
+              << "  output:   [--dl-metrics host:port] [--dl-log path] [--dl-trace dir]\n"
+              << "  readmit:  [--dl-readmit off|restart|immediate] [--dl-readmit-probes n] [--dl-readmit-uptime ms]\n"
+              << "  layout:   [--dl-rpc-order 0|1] [--dl-sticky-slack fraction]"
+              << " [--dl-ladder ctx=n+batch=n+model=path,...]\n"
+              << "  model:    [--dl-model-cache off|warm|pin] [--dl-model-stage dir] [--dl-model-stage-keep 0|1]\n"
+              << "  cluster:  [--dl-cluster file] [--dl-dns-ttl ms] [--dl-score-file path|off] [--dl-score-half-life s]"
+              << " [--dl-flaky-score x]\n"
+              << "  batch:    [--dl-batch file|dir] [--dl-batch-out path]\n"
+              << "  standby:  [--dl-standby off|cpu|minus-one]\n"
+              << "The --dl-model-stage copy is left in dir when the supervisor exits, so the next run reuses it;"
+              << " --dl-model-stage-keep 0 removes it on an orderly shutdown.\n";
+}
+
 int main(int argc, char** argv) { // for command line arguments
     std::vector<std::string> rpc_servers; // store rpc server addresses in a vector
+    std::vector<std::string> llama_args; // everything that isn't a wrapper option goes to llama-cli
+    SupervisorConfig config;
+    int status = 0;
 
-    // Register signal handler for graceful termination
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    // handlers for interrupt signals
+    // the event loop reads these from a signalfd, block them before any thread starts so none of them gets a stray copy
+    sigset_t mask = supervisor_signals();
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    signal(SIGPIPE, SIG_IGN); // a closed stdout shows up as EPIPE and shuts us down cleanly
 
     for (int i = 1; i < argc - 1; i++) { // parse server addresses from command line
         if (strcmp(argv[i], "--rpc") == 0) {
@@ -328,13 +5079,56 @@ int main(int argc, char** argv) { // for command line arguments
         }
     }
 
-    if (rpc_servers.empty()) {
-        std::cerr << "Usage: " << argv[0] << " [llama.cpp options] --rpc server1:port1,server2:port2,...\n";
+    for (int i = 1; i < argc; i++) { // split wrapper options from llama-cli args
+        if (SupervisorConfig::is_option(argv[i])) {
+            bool parsed = false;
+            try {
+                parsed = i + 1 < argc && config.parse_option(argv[i], argv[i + 1]);
+            } catch (const std::exception&) { // std::stoi/std::stod on a value that isn't a number
+                std::cerr << "Invalid value for " << argv[i] << ": " << argv[i + 1] << "\n";
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parsed) {
+                std::cerr << "Unknown or incomplete option " << argv[i] << "\n";
+                print_usage(argv[0]);
+                return 1;
+            }
+            i++; // skip the value
+        } else {
+            llama_args.push_back(argv[i]);
+        }
+    }
+    if (!config.batch_path.empty()) config.mode = "server"; // a batch needs llama-server's HTTP API
+
+    std::vector<NodeSpec> nodes;
+    if (!config.cluster_path.empty()) { // the file wins over --rpc, it's the one SIGHUP re-reads
+        std::string error;
+        if (!ClusterFile::load(config.cluster_path, nodes, error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    } else {
+        for (const auto& address : rpc_servers) {
+            NodeSpec node;
+            node.address = address;
+            nodes.push_back(node);
+        }
+    }
+
+    if (nodes.empty()) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    DurableLLaMA llama(rpc_servers, argc, argv); //create and run wrapper
-    llama.run();
+    if (!event_log.start(config.log_path)) return 1;
+    event_log.emit("supervisor_started").field("pid", getpid()).field("servers", nodes.size()).field("mode", config.mode);
+    {
+        DurableLLaMA llama(nodes, llama_args, config); //create and run wrapper
+        llama.run();
+        status = llama.batch_failed() || llama.launch_failed() ? 1 : 0;
+    }
+    event_log.stop(); // flush before exit
 
-    return 0;
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,476 @@
+// failover benchmark: runs the supervisor against mock-llama-cli and mock-rpc-server, injects faults and
+// times the recovery from the supervisor's own event log. nothing here needs a Pi or a model
+//
+//   g++ -std=c++17 -O2 -pthread -o durable-llama "Durable Llama.cpp"
+//   g++ -std=c++17 -O2 -o bench/mock-llama-cli bench/mock_llama_cli.cpp
+//   g++ -std=c++17 -O2 -pthread -o bench/mock-rpc-server bench/mock_rpc_server.cpp
+//   g++ -std=c++17 -O2 -o bench/failover-bench bench/failover_bench.cpp
+//   bench/failover-bench [--supervisor ./durable-llama] [--mock-cli bench/mock-llama-cli]
+//       [--mock-rpc bench/mock-rpc-server] [--servers 3] [--port 47600] [--trials 5] [--rate 50]
+//       [--scenarios steady,stall,crash,rpc-down,rpc-blackhole,rpc-slow,resume,throughput] [--duration-ms 3000]
+//       [--timeout-ms 20000] [-- supervisor options...]
+//
+// per scenario it reports, as p50 / max over the trials:
+//   detect   fault to the supervisor's event for it (stalled, backend_exited, server_removed)
+//   restart  that event to back_in_service, the first output of the replacement
+//   recover  fault to back_in_service, what a reader of the stream actually waits
+//   cpu      supervisor CPU over the trial, as a share of one core
+// steady injects nothing and fails if the supervisor drops a server or relaunches anyway, over --duration-ms
+// or 6 s, whichever is longer: long enough for several monitor rounds against servers the mock keeps busy.
+// resume runs with --dl-resume 1 and -n, crashes the first llama-cli partway, and fails unless the stream that
+// comes out is the prompt and exactly -n tokens in order, none repeated or lost across the restart.
+// throughput forwards 4 KiB tokens as fast as the mock can write them and reports MiB/s through the
+// supervisor's stdout along with its CPU. events and mocks share CLOCK_MONOTONIC, so the times compare
+// directly. the exit status is 1 if any trial failed, so a script can gate on it
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+static uint64_t monotonic_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream in(text);
+    std::string part;
+    while (std::getline(in, part, separator)) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+struct Event { // one line of the supervisor's JSON log, only the bits the bench looks at
+    std::string name;
+    uint64_t ts_us = 0;
+    std::string line;
+
+    std::string text(const std::string& key) const { // value of a string or number field, empty if absent
+        std::string needle = "\"" + key + "\":";
+        size_t at = line.find(needle);
+        if (at == std::string::npos) return "";
+        at += needle.size();
+        if (line[at] == '"') {
+            size_t end = line.find('"', at + 1);
+            return line.substr(at + 1, end - at - 1);
+        }
+        size_t end = line.find_first_of(",}", at);
+        return line.substr(at, end - at);
+    }
+
+    static Event parse(const std::string& line) {
+        Event event;
+        event.line = line;
+        event.name = event.text("event");
+        event.ts_us = strtoull(event.text("ts_us").c_str(), nullptr, 10);
+        return event;
+    }
+};
+
+struct BenchConfig {
+    std::string supervisor = "./durable-llama";
+    std::string mock_cli = "bench/mock-llama-cli";
+    std::string mock_rpc = "bench/mock-rpc-server";
+    int servers = 3;
+    int port = 47600;
+    int trials = 5;
+    int rate = 50; // tokens per second from the mock
+    int duration_ms = 3000; // throughput window
+    int timeout_ms = 20000; // per step, a trial that doesn't recover by then counts as failed
+    std::vector<std::string> scenarios = {"steady", "stall", "crash", "rpc-down", "rpc-blackhole", "rpc-slow", "resume",
+                                          "throughput"};
+    std::vector<std::string> supervisor_args; // everything after --
+};
+
+static pid_t spawn(const std::vector<std::string>& argv, const std::vector<std::string>& env, int* out_fd, int* err_fd) {
+    int out[2] = {-1, -1}, err[2] = {-1, -1};
+    if ((out_fd && pipe2(out, O_CLOEXEC) < 0) || (err_fd && pipe2(err, O_CLOEXEC) < 0)) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (out_fd) dup2(out[1], STDOUT_FILENO);
+        if (err_fd) dup2(err[1], STDERR_FILENO);
+        for (const auto& entry : env) putenv(strdup(entry.c_str()));
+        std::vector<char*> args;
+        for (const auto& arg : argv) args.push_back(const_cast<char*>(arg.c_str()));
+        args.push_back(nullptr);
+        execv(args[0], args.data());
+        perror(("exec " + argv[0]).c_str());
+        _exit(127);
+    }
+    if (out_fd) {
+        close(out[1]);
+        *out_fd = out[0];
+    }
+    if (err_fd) {
+        close(err[1]);
+        *err_fd = err[0];
+    }
+    return pid;
+}
+
+static void reap(pid_t pid, int grace_ms) { // SIGINT was already sent, escalate if it doesn't go
+    for (int waited = 0; waited < grace_ms; waited += 10) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) return;
+        usleep(10000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+static uint64_t cpu_ticks(pid_t pid) { // utime + stime of the process itself, not its children
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t close_paren = stat.rfind(')');
+    if (close_paren == std::string::npos) return 0;
+    std::istringstream fields(stat.substr(close_paren + 2));
+    std::string field;
+    uint64_t utime = 0, stime = 0;
+    for (int i = 3; fields >> field; i++) { // fields are numbered from 1, the state is 3
+        if (i == 14) utime = std::stoull(field);
+        if (i == 15) {
+            stime = std::stoull(field);
+            break;
+        }
+    }
+    return utime + stime;
+}
+
+// one supervisor with its mock cluster, pumped from the bench thread
+class Session {
+public:
+    std::vector<pid_t> rpc_pids;
+    pid_t supervisor = -1;
+    uint64_t started_us = 0;
+    uint64_t output_bytes = 0;
+    std::string output; // the supervisor's stdout, only kept when asked for
+    bool output_closed = false;
+    std::vector<Event> events;
+
+    Session(const BenchConfig& config, const std::vector<std::string>& mock_env, const std::vector<std::string>& llama_args = {},
+            bool keep_output = false) : keep_output(keep_output) {
+        std::string rpc;
+        for (int i = 0; i < config.servers; i++) {
+            std::string address = "127.0.0.1:" + std::to_string(config.port + i);
+            rpc_pids.push_back(spawn({config.mock_rpc, address}, {}, nullptr, nullptr));
+            rpc += (i > 0 ? "," : "") + address;
+        }
+        usleep(100000); // let the mocks bind before the supervisor checks them
+
+        std::vector<std::string> argv = {config.supervisor, "--rpc", rpc, "--dl-binary", config.mock_cli};
+        argv.insert(argv.end(), config.supervisor_args.begin(), config.supervisor_args.end());
+        for (const char* arg : {"-m", "bench.gguf", "-p", "bench", "-ngl", "99"}) argv.push_back(arg);
+        argv.insert(argv.end(), llama_args.begin(), llama_args.end());
+        started_us = monotonic_us();
+        supervisor = spawn(argv, mock_env, &out_fd, &err_fd);
+        started_ticks = cpu_ticks(supervisor);
+    }
+
+    ~Session() {
+        if (supervisor > 0) {
+            kill(supervisor, SIGINT);
+            reap(supervisor, 5000);
+        }
+        for (pid_t pid : rpc_pids) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        if (out_fd >= 0) close(out_fd);
+        if (err_fd >= 0) close(err_fd);
+    }
+
+    double cpu_percent() const { // over the life of the session so far
+        double elapsed_s = (monotonic_us() - started_us) / 1e6;
+        double cpu_s = (double)(cpu_ticks(supervisor) - started_ticks) / sysconf(_SC_CLK_TCK);
+        return elapsed_s > 0 ? 100.0 * cpu_s / elapsed_s : 0;
+    }
+
+    void pump(int timeout_ms) { // one round of draining both pipes
+        pollfd pfds[2] = {{output_closed ? -1 : out_fd, POLLIN, 0}, {err_fd, POLLIN, 0}}; // -1: poll skips it
+        if (poll(pfds, 2, timeout_ms) <= 0) return;
+        if (pfds[0].revents) {
+            ssize_t n = read(out_fd, buffer, sizeof(buffer));
+            if (n > 0) output_bytes += n;
+            if (n > 0 && keep_output) output.append(buffer, n);
+            if (n == 0) output_closed = true;
+        }
+        if (pfds[1].revents) {
+            ssize_t n = read(err_fd, buffer, sizeof(buffer));
+            if (n > 0) pending.append(buffer, n);
+            size_t newline;
+            while ((newline = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, newline);
+                pending.erase(0, newline + 1);
+                if (!line.empty() && line[0] == '{') events.push_back(Event::parse(line));
+            }
+        }
+    }
+
+    void pump_for(int ms) {
+        uint64_t until = monotonic_us() + (uint64_t)ms * 1000;
+        for (uint64_t now; (now = monotonic_us()) < until;) pump((until - now) / 1000 + 1);
+    }
+
+    // first event from `from` on with one of these names, pumping until it shows up or the deadline passes
+    const Event* wait_event(size_t from, const std::vector<std::string>& names, uint64_t deadline_us) {
+        for (;;) {
+            for (size_t i = from; i < events.size(); i++) {
+                if (std::find(names.begin(), names.end(), events[i].name) != names.end()) return &events[i];
+            }
+            uint64_t now = monotonic_us();
+            if (now >= deadline_us) return nullptr;
+            pump(std::min<uint64_t>(100, (deadline_us - now) / 1000 + 1));
+        }
+    }
+
+    bool wait_closed(uint64_t deadline_us) { // the supervisor is done and has closed its stdout
+        while (!output_closed) {
+            uint64_t now = monotonic_us();
+            if (now >= deadline_us) return false;
+            pump(std::min<uint64_t>(100, (deadline_us - now) / 1000 + 1));
+        }
+        return true;
+    }
+
+    bool wait_output(uint64_t bytes, uint64_t deadline_us) {
+        while (output_bytes < bytes) {
+            uint64_t now = monotonic_us();
+            if (now >= deadline_us) return false;
+            pump(std::min<uint64_t>(100, (deadline_us - now) / 1000 + 1));
+        }
+        return true;
+    }
+
+private:
+    bool keep_output;
+    int out_fd = -1;
+    int err_fd = -1;
+    uint64_t started_ticks = 0;
+    std::string pending;
+    char buffer[65536];
+};
+
+struct Trial {
+    bool ok = false;
+    std::string failure;
+    double detect_ms = 0, restart_ms = 0, recover_ms = 0;
+    double cpu_percent = 0;
+    double mib_per_s = 0;
+};
+
+static uint64_t read_fault_stamp(const std::string& path) {
+    std::ifstream in(path);
+    uint64_t stamp = 0;
+    in >> stamp;
+    return stamp;
+}
+
+static Trial run_trial(const BenchConfig& config, const std::string& scenario, int trial) {
+    Trial result;
+    std::string fault_file = "/tmp/failover-bench-" + std::to_string(getpid()) + "-" + std::to_string(trial);
+    unlink(fault_file.c_str());
+    std::vector<std::string> env = {"MOCK_FAULT_FILE=" + fault_file,
+                                    "MOCK_FAULT_AFTER=" + std::to_string(config.rate)}; // about a second in
+    if (scenario == "stall" || scenario == "crash") env.push_back("MOCK_FAULT=" + scenario);
+    if (scenario == "resume") env.push_back("MOCK_FAULT=crash");
+    if (scenario == "throughput") {
+        env.push_back("MOCK_RATE=0");
+        env.push_back("MOCK_TOKEN_BYTES=4096");
+    } else {
+        env.push_back("MOCK_RATE=" + std::to_string(config.rate));
+    }
+
+    int n_predict = 3 * config.rate; // about three seconds, the crash comes after the first
+    std::vector<std::string> llama_args;
+    if (scenario == "resume") llama_args = {"--dl-resume", "1", "-n", std::to_string(n_predict)};
+    Session session(config, env, llama_args, scenario == "resume");
+    uint64_t step = (uint64_t)config.timeout_ms * 1000;
+    const Event* started = session.wait_event(0, {"backend_started"}, monotonic_us() + step);
+    if (!started) {
+        result.failure = "supervisor never started a backend";
+        return result;
+    }
+    pid_t cli = std::stoi(started->text("pid"));
+    if (!session.wait_output(1, monotonic_us() + step)) {
+        result.failure = "no output from the first run";
+        return result;
+    }
+
+    if (scenario == "throughput") {
+        session.pump_for(200); // past the first write
+        uint64_t bytes = session.output_bytes;
+        uint64_t from = monotonic_us();
+        double cpu_before = (double)cpu_ticks(session.supervisor);
+        session.pump_for(config.duration_ms);
+        double elapsed_s = (monotonic_us() - from) / 1e6;
+        double cpu_s = (cpu_ticks(session.supervisor) - cpu_before) / sysconf(_SC_CLK_TCK);
+        result.mib_per_s = (session.output_bytes - bytes) / elapsed_s / (1 << 20);
+        result.cpu_percent = 100.0 * cpu_s / elapsed_s;
+        result.ok = true;
+        return result;
+    }
+
+    if (scenario == "steady") {
+        size_t from = session.events.size();
+        session.pump_for(std::max(config.duration_ms, 6000));
+        for (size_t i = from; i < session.events.size(); i++) {
+            const Event& event = session.events[i];
+            if (event.name == "server_removed" || event.name == "backend_started") {
+                result.failure = "nothing was wrong, got " + event.line;
+                return result;
+            }
+        }
+        result.cpu_percent = session.cpu_percent();
+        result.ok = true;
+        return result;
+    }
+
+    size_t cursor = session.events.size();
+    uint64_t fault_us = 0;
+    std::vector<std::string> detected_by = {"stalled"};
+    if (scenario == "crash" || scenario == "resume") detected_by = {"backend_exited", "backend_killed"};
+    if (scenario == "rpc-down" || scenario == "rpc-blackhole" || scenario == "rpc-slow") {
+        session.pump_for(1000); // give the stall detector a token rate to work from
+        cursor = session.events.size();
+        if (scenario == "rpc-down") {
+            fault_us = monotonic_us();
+            kill(session.rpc_pids.back(), SIGKILL);
+            detected_by = {"server_removed", "backend_exited"}; // the monitor, or llama-cli losing its connection
+        } else {
+            if (scenario == "rpc-blackhole") kill(session.rpc_pids.back(), SIGUSR1);
+            else for (pid_t pid : session.rpc_pids) kill(pid, SIGUSR2);
+            kill(cli, SIGUSR1); // generation hangs on the server that stopped answering
+        }
+    }
+
+    const Event* detected = session.wait_event(cursor, detected_by, monotonic_us() + step);
+    if (!fault_us) fault_us = read_fault_stamp(fault_file);
+    if (!detected || !fault_us) {
+        result.failure = detected ? "fault never fired" : "fault not detected";
+        return result;
+    }
+    uint64_t detected_us = detected->ts_us;
+    const Event* back = session.wait_event(detected - session.events.data(), {"back_in_service"}, monotonic_us() + step);
+    if (!back) {
+        result.failure = "no output after the restart";
+        return result;
+    }
+    result.detect_ms = (double)((int64_t)detected_us - (int64_t)fault_us) / 1000.0;
+    result.restart_ms = (back->ts_us - detected_us) / 1000.0;
+    result.recover_ms = (double)((int64_t)back->ts_us - (int64_t)fault_us) / 1000.0;
+    result.cpu_percent = session.cpu_percent();
+    unlink(fault_file.c_str());
+
+    if (scenario == "resume") { // let the replacement finish, then check the stream it carried on
+        if (!session.wait_closed(monotonic_us() + step)) {
+            result.failure = "the resumed run never finished";
+            return result;
+        }
+        std::string expected = "bench";
+        for (int i = 0; i < n_predict; i++) {
+            std::string token = std::to_string(i);
+            expected += std::string(5 - std::min<size_t>(5, token.size()), '0') + token + " "; // the mock's 6 byte tokens
+        }
+        expected += "\n";
+        if (session.output != expected) {
+            size_t at = std::mismatch(expected.begin(), expected.end(), session.output.begin(), session.output.end()).first -
+                        expected.begin();
+            result.failure = "resumed output differs at byte " + std::to_string(at) + " of " + std::to_string(expected.size()) +
+                             ", got " + std::to_string(session.output.size()) + " bytes";
+            return result;
+        }
+    }
+    result.ok = true;
+    return result;
+}
+
+static std::string p50_max(std::vector<double> values) {
+    if (values.empty()) return "-";
+    std::sort(values.begin(), values.end());
+    char text[64];
+    snprintf(text, sizeof(text), "%.1f / %.1f", values[values.size() / 2], values.back());
+    return text;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string name = argv[i];
+        if (name == "--") {
+            config.supervisor_args.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << name << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (name == "--supervisor") config.supervisor = value;
+        else if (name == "--mock-cli") config.mock_cli = value;
+        else if (name == "--mock-rpc") config.mock_rpc = value;
+        else if (name == "--servers") config.servers = std::max(1, std::stoi(value));
+        else if (name == "--port") config.port = std::stoi(value);
+        else if (name == "--trials") config.trials = std::max(1, std::stoi(value));
+        else if (name == "--rate") config.rate = std::max(1, std::stoi(value));
+        else if (name == "--scenarios") config.scenarios = split(value, ',');
+        else if (name == "--duration-ms") config.duration_ms = std::max(100, std::stoi(value));
+        else if (name == "--timeout-ms") config.timeout_ms = std::max(1000, std::stoi(value));
+        else {
+            std::cerr << "Unknown option " << name << std::endl;
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int failed = 0; // trials across all scenarios, any of them makes the exit status non-zero
+    printf("%-14s %7s %20s %20s %20s %14s\n", "scenario", "ok", "detect ms", "restart ms", "recover ms", "cpu %");
+    for (const auto& scenario : config.scenarios) {
+        std::vector<double> detect, restart, recover, cpu, throughput;
+        int ok = 0;
+        for (int trial = 0; trial < config.trials; trial++) {
+            Trial result = run_trial(config, scenario, trial);
+            if (!result.ok) {
+                std::cerr << scenario << " trial " << trial + 1 << ": " << result.failure << std::endl;
+                failed++;
+                continue;
+            }
+            ok++;
+            detect.push_back(result.detect_ms);
+            restart.push_back(result.restart_ms);
+            recover.push_back(result.recover_ms);
+            cpu.push_back(result.cpu_percent);
+            throughput.push_back(result.mib_per_s);
+        }
+        std::string trials = std::to_string(ok) + "/" + std::to_string(config.trials);
+        if (scenario == "steady") {
+            printf("%-14s %7s %20s %20s %20s %14s\n", scenario.c_str(), trials.c_str(), "", "", "", p50_max(cpu).c_str());
+        } else if (scenario == "throughput") {
+            printf("%-14s %7s %20s %20s %20s %14s\n", scenario.c_str(), trials.c_str(), (p50_max(throughput) + " MiB/s").c_str(), "", "",
+                   p50_max(cpu).c_str());
+        } else {
+            printf("%-14s %7s %20s %20s %20s %14s\n", scenario.c_str(), trials.c_str(), p50_max(detect).c_str(),
+                   p50_max(restart).c_str(), p50_max(recover).c_str(), p50_max(cpu).c_str());
+        }
+        fflush(stdout);
+    }
+    if (failed > 0) std::cerr << failed << " trial" << (failed > 1 ? "s" : "") << " failed" << std::endl;
+    return failed > 0 ? 1 : 0;
+}
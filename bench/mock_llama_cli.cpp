@@ -0,0 +1,222 @@
+// stand-in for llama-cli when benchmarking the supervisor: prints the load marker, then tokens at a fixed rate,
+// and stalls or crashes on cue. everything comes from the environment since the supervisor owns argv
+//
+//   g++ -std=c++17 -O2 -o bench/mock-llama-cli bench/mock_llama_cli.cpp
+//
+//   MOCK_LOAD_MS       time spent "loading" before the generate: line (default 200)
+//   MOCK_PROMPT_MS     time between the generate: line and the first token (default 50)
+//   MOCK_RATE          tokens per second, 0 for as fast as the pipe takes them (default 50)
+//   MOCK_TOKEN_BYTES   bytes per token, including the trailing space (default 6)
+//   MOCK_TOKENS        tokens before a clean exit, 0 for no limit, -n wins over it (default 0)
+//   MOCK_FAULT         none, stall or crash (default none)
+//   MOCK_FAULT_AFTER   tokens written before the fault (default 50)
+//   MOCK_FAULT_FILE    the fault only fires if this file doesn't exist yet, and it gets the monotonic
+//                      time of the fault in microseconds. one fault per file, so restarts run clean
+//
+// SIGUSR1 stalls and SIGUSR2 crashes right away, for faults the bench wants to time itself. both still
+// go through MOCK_FAULT_FILE
+//
+// tokens are their zero-padded index and a space, one write() each. the index carries on from the spaces
+// already in the -p prompt, so a resumed run continues the count and a gap or a repeat shows in the output.
+// the prompt is echoed first unless --no-display-prompt is given, as llama-cli does
+//
+// like llama-cli it connects to every --rpc server during the load, says HELLO, and keeps the connections for
+// the whole run: a server that can't be reached fails the load, one that hangs up mid-run ends it with exit 1
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static volatile sig_atomic_t signalled_fault = 0; // 1 stall, 2 crash
+
+static void on_fault_signal(int sig) {
+    signalled_fault = sig == SIGUSR1 ? 1 : 2;
+}
+
+static long env_long(const char* name, long fallback) {
+    const char* value = getenv(name);
+    return value && *value ? strtol(value, nullptr, 10) : fallback;
+}
+
+static uint64_t monotonic_us() { // same clock as the supervisor's steady_clock, so the bench can compare
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(timespec deadline) {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+        if (signalled_fault) return;
+    }
+}
+
+static void add_ns(timespec& ts, long ns) {
+    ts.tv_nsec += ns;
+    while (ts.tv_nsec >= 1000000000L) {
+        ts.tv_nsec -= 1000000000L;
+        ts.tv_sec++;
+    }
+}
+
+static bool claim_fault() { // first process to get here takes the fault and stamps the time
+    const char* path = getenv("MOCK_FAULT_FILE");
+    if (!path || !*path) return true;
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return false; // already fired on an earlier run
+    std::string stamp = std::to_string(monotonic_us()) + "\n";
+    if (write(fd, stamp.data(), stamp.size()) < 0) perror("fault file");
+    close(fd);
+    return true;
+}
+
+static bool write_all(const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static int rpc_connect(const std::string& address) { // connect and HELLO, -1 if the server isn't there
+    size_t colon = address.rfind(':');
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (colon == std::string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &addr.sin_addr) != 1) return -1;
+    addr.sin_port = htons(atoi(address.c_str() + colon + 1));
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    char hello[9] = {14}; // RPC_CMD_HELLO, empty payload
+    uint64_t size = 0;
+    char version[3];
+    if (send(fd, hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello) || !read_all(fd, &size, sizeof(size)) ||
+        size != sizeof(version) || !read_all(fd, version, sizeof(version))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool rpc_alive(const std::vector<int>& servers) { // nothing arrives unasked, so readable means hung up
+    for (int fd : servers) {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 0) > 0) return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    long load_ms = env_long("MOCK_LOAD_MS", 200);
+    long prompt_ms = env_long("MOCK_PROMPT_MS", 50);
+    long rate = env_long("MOCK_RATE", 50);
+    long token_bytes = std::max(1L, env_long("MOCK_TOKEN_BYTES", 6));
+    long max_tokens = env_long("MOCK_TOKENS", 0);
+    long fault_after = env_long("MOCK_FAULT_AFTER", 50);
+    std::string fault = getenv("MOCK_FAULT") ? getenv("MOCK_FAULT") : "none";
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_fault_signal; // no SA_RESTART, a signal cuts the current sleep short
+    sigaction(SIGUSR1, &sa, nullptr);
+    sigaction(SIGUSR2, &sa, nullptr);
+    signal(SIGPIPE, SIG_DFL);
+
+    const char* prompt = nullptr;
+    const char* rpc = nullptr;
+    bool display_prompt = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-display-prompt") == 0) display_prompt = false;
+        if (i + 1 >= argc) continue;
+        if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--prompt") == 0) prompt = argv[i + 1];
+        if (strcmp(argv[i], "--rpc") == 0) rpc = argv[i + 1];
+        if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--predict") == 0 || strcmp(argv[i], "--n-predict") == 0) {
+            long n = strtol(argv[i + 1], nullptr, 10);
+            max_tokens = n > 0 ? n : 0; // -1 is llama-cli's no limit
+        }
+    }
+    long first_index = prompt ? (long)std::count(prompt, prompt + strlen(prompt), ' ') : 0;
+
+    std::vector<int> servers;
+    for (const char* at = rpc; at && *at;) { // one connection per server for the life of the process
+        const char* comma = strchr(at, ',');
+        std::string address = comma ? std::string(at, comma - at) : std::string(at);
+        int fd = rpc_connect(address);
+        if (fd < 0) {
+            fprintf(stderr, "failed to connect to rpc server %s\n", address.c_str());
+            return 1;
+        }
+        servers.push_back(fd);
+        at = comma ? comma + 1 : nullptr;
+    }
+
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    add_ns(next, load_ms * 1000000L);
+    sleep_until(next);
+    fprintf(stderr, "generate: n_ctx = 4096, n_batch = 2048, n_predict = -1, n_keep = 1\n"); // the supervisor's load marker
+    fflush(stderr);
+    if (prompt && display_prompt && !write_all(prompt, strlen(prompt))) return 1; // llama-cli echoes the prompt first
+
+    add_ns(next, prompt_ms * 1000000L);
+    sleep_until(next);
+
+    long interval_ns = rate > 0 ? 1000000000L / rate : 0;
+    for (long written = 0; max_tokens == 0 || written < max_tokens; written++) {
+        int pending = signalled_fault;
+        if (!pending && written == fault_after) pending = fault == "stall" ? 1 : fault == "crash" ? 2 : 0;
+        if (pending) {
+            signalled_fault = 0;
+            if (claim_fault()) {
+                if (pending == 2) _exit(1);
+                for (;;) pause(); // silent until the supervisor kills us
+            }
+        }
+        if (!rpc_alive(servers)) {
+            fprintf(stderr, "rpc server hung up\n");
+            return 1;
+        }
+        std::string token = std::to_string(first_index + written);
+        if ((long)token.size() < token_bytes - 1) token.insert(0, token_bytes - 1 - token.size(), '0');
+        token += ' ';
+        if (!write_all(token.data(), token.size())) return 1; // supervisor went away
+        if (interval_ns > 0) {
+            add_ns(next, interval_ns);
+            sleep_until(next);
+        }
+    }
+    write_all("\n", 1);
+    return 0;
+}
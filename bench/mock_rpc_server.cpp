@@ -0,0 +1,144 @@
+// stand-in for ggml's rpc-server when benchmarking the supervisor: answers HELLO and GET_DEVICE_MEMORY like
+// the real one, holds the connection open afterwards, and can be told to stop answering or slow down. it also
+// queues like the real one: listen() backlog 1 and one client at a time, so while llama-cli is connected every
+// other connection waits in the kernel and a third one gets no handshake at all
+//
+//   g++ -std=c++17 -O2 -pthread -o bench/mock-rpc-server bench/mock_rpc_server.cpp
+//   bench/mock-rpc-server 127.0.0.1:50053 [--free-mib N] [--total-mib N] [--delay-ms N]
+//
+// SIGUSR1 toggles blackhole (connections are accepted, nothing is ever answered), SIGUSR2 toggles the
+// --delay-ms before every reply. to go unreachable, kill it; the port refuses until it is started again
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static constexpr uint8_t RPC_CMD_GET_DEVICE_MEMORY = 11;
+static constexpr uint8_t RPC_CMD_HELLO = 14;
+
+static std::atomic<bool> blackhole{false};
+static std::atomic<bool> slow{false};
+static int delay_ms = 50;
+static uint64_t free_mem = 3ULL << 30;
+static uint64_t total_mem = 4ULL << 30;
+
+static void on_signal(int sig) { // atomics only, both are lock-free
+    if (sig == SIGUSR1) blackhole = !blackhole;
+    else slow = !slow;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool reply(int fd, const std::string& payload) { // ggml-rpc framing: u64 size then the payload
+    if (slow) std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    std::string message(sizeof(uint64_t), '\0');
+    uint64_t size = payload.size();
+    memcpy(&message[0], &size, sizeof(size));
+    message += payload;
+    return write_all(fd, message.data(), message.size());
+}
+
+static void serve(int fd) { // the one client, until it hangs up
+    for (;;) {
+        uint8_t cmd;
+        uint64_t size;
+        if (!read_all(fd, &cmd, 1) || !read_all(fd, &size, sizeof(size))) break;
+        std::string request(size, '\0');
+        if (size > 0 && !read_all(fd, &request[0], size)) break;
+        while (blackhole) std::this_thread::sleep_for(std::chrono::milliseconds(10)); // read it, never answer
+
+        if (cmd == RPC_CMD_HELLO) {
+            if (!reply(fd, std::string("\x03\x00\x00", 3))) break; // protocol 3.0.0
+        } else if (cmd == RPC_CMD_GET_DEVICE_MEMORY) {
+            std::string payload(2 * sizeof(uint64_t), '\0');
+            memcpy(&payload[0], &free_mem, sizeof(free_mem));
+            memcpy(&payload[sizeof(free_mem)], &total_mem, sizeof(total_mem));
+            if (!reply(fd, payload)) break;
+        } else {
+            break; // anything else a real client would send needs a real backend
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " host:port [--free-mib N] [--total-mib N] [--delay-ms N]" << std::endl;
+        return 1;
+    }
+    std::string address = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        if (name == "--free-mib") free_mem = std::stoull(argv[i + 1]) << 20;
+        else if (name == "--total-mib") total_mem = std::stoull(argv[i + 1]) << 20;
+        else if (name == "--delay-ms") delay_ms = std::stoi(argv[i + 1]);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, nullptr);
+    sigaction(SIGUSR2, &sa, nullptr);
+
+    size_t colon = address.rfind(':');
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (colon == std::string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Can't listen on " << address << std::endl;
+        return 1;
+    }
+    addr.sin_port = htons(std::stoi(address.substr(colon + 1)));
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0) { // rpc-server's backlog
+        perror(("listen on " + address).c_str());
+        return 1;
+    }
+
+    for (;;) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            return 1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        serve(fd); // the next accept waits for this client to go
+    }
+}